@@ -0,0 +1,311 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+enum class tokenKind
+{
+    Unknown,
+    Program,
+    Identifier,
+    VariableDeclaration,
+    FunctionDeclaration,
+    IfStmt,
+    ForLoopStmt,
+    WhileLoopStmt,
+    ReturnStmt,
+    CallExpr,
+    AssignmentExpr,
+    MemberExpr,
+    ObjectLiteral,
+    NumberLiteral,
+    StringLiteral,
+    BooleanLiteral,
+    BinaryExpr,
+    ComparisonExpr,
+    UnaryExpr,
+    LogicGateExpr,
+    Keyword,
+    Import,
+    Export,
+    Extern,
+};
+
+// nodes, strings and lists of one parse are referred to by 32 bit indices
+// into the ast that owns them
+using node_index = uint32_t;
+using string_index = uint32_t;
+
+constexpr node_index no_node = UINT32_MAX;
+// every ast interns the empty string first
+constexpr string_index empty_string = 0;
+
+// a run of node or string indices in ast::lists, nodes default their lists
+// to empty so the parser only names the ones it has
+struct node_list {
+    uint32_t begin = 0;
+    uint32_t size = 0;
+};
+
+// where the resolver found a variable, the slot indexes the global slots of
+// the root scope, the frame of the running function or its upvalues
+enum class variable_kind : uint8_t { global, local, upvalue };
+
+// the node structs only hold the fields of their kinds. bindings, slots and
+// prototypes are filled in by the resolver
+
+// Identifier
+struct identifier_node {
+    string_index name;
+    variable_kind binding = variable_kind::global;
+    int slot = -1;
+};
+
+// NumberLiteral, StringLiteral, BooleanLiteral and Keyword, string literals
+// keep their quotes. number literals are parsed once into number
+struct literal_node {
+    string_index value;
+    double number = 0;
+    int slot = -1;
+};
+
+// BinaryExpr, ComparisonExpr, LogicGateExpr and AssignmentExpr
+struct binary_node {
+    node_index left;
+    node_index right;
+    string_index op = empty_string;
+};
+
+// UnaryExpr, ReturnStmt and Export
+struct unary_node {
+    node_index right;
+    string_index op = empty_string;
+};
+
+// VariableDeclaration
+struct variable_node {
+    string_index name;
+    node_index value;
+    variable_kind binding = variable_kind::global;
+    int slot = -1;
+};
+
+// FunctionDeclaration, params is a list of strings
+struct function_node {
+    string_index name;
+    node_list params{};
+    node_list body{};
+    variable_kind binding = variable_kind::global;
+    int slot = -1;
+    // index in gem_prototypes
+    int prototype = -1;
+};
+
+// CallExpr
+struct call_node {
+    node_index caller;
+    node_list args{};
+};
+
+// MemberExpr, the property name of a non-computed member is interned by the
+// resolver as constant key and slot is the inline cache of the site
+struct member_node {
+    node_index object;
+    node_index property;
+    bool computed;
+    int key = -1;
+    int slot = -1;
+};
+
+// ObjectLiteral, properties holds key and value of every property in turn
+struct object_node {
+    node_list properties{};
+};
+
+// IfStmt, the elifs are if nodes without elifs or else body of their own
+struct if_node {
+    node_index condition;
+    node_list body{};
+    node_list elifs{};
+    node_list else_body{};
+};
+
+// loops keep their locals in the frame of the function they run in, starting
+// at first_slot
+
+// WhileLoopStmt
+struct while_node {
+    node_index condition;
+    node_list body{};
+    int first_slot = 0;
+    int slot_count = 0;
+};
+
+// ForLoopStmt, range holds the start, end and step of a numerical loop.
+// params is a list of strings
+struct for_node {
+    node_list params{};
+    node_list range{};
+    node_list body{};
+    int slot = -1;
+    int first_slot = 0;
+    int slot_count = 0;
+};
+
+// Import, names is a list of strings
+struct import_node {
+    node_index path;
+    node_list names{};
+};
+
+// Extern, params is a list of strings
+struct extern_node {
+    string_index name;
+    node_index path;
+    node_list params{};
+    string_index return_type;
+};
+
+// a node is its kind, its line and the index of its fields in the pool of
+// their struct
+struct ast_node {
+    tokenKind kind;
+    int line;
+    uint32_t data;
+};
+
+// every node of one parse, the pools only grow while parsing so the
+// references handed out by get stay valid once the parser is done
+class ast {
+  public:
+    // the top level statements
+    node_list body{};
+
+    ast() {
+        intern("");
+    }
+
+    // string_indices points into strings, so an ast can only be moved
+    ast(const ast &) = delete;
+    ast &operator=(const ast &) = delete;
+    ast(ast &&) = default;
+    ast &operator=(ast &&) = default;
+
+    template <typename T>
+    node_index add(tokenKind kind, int line, const T &fields) {
+        std::vector<T> &nodes = pool<T>();
+        nodes.push_back(fields);
+        headers.push_back(ast_node{kind, line, uint32_t(nodes.size() - 1)});
+        return headers.size() - 1;
+    }
+
+    template <typename T> T &get(node_index node) {
+        return pool<T>()[headers[node].data];
+    }
+
+    template <typename T> const T &get(node_index node) const {
+        return pool<T>()[headers[node].data];
+    }
+
+    // gives a node new fields of another kind, the old fields stay unused in
+    // their pool
+    template <typename T>
+    void replace(node_index node, tokenKind kind, const T &fields) {
+        std::vector<T> &nodes = pool<T>();
+        nodes.push_back(fields);
+        headers[node].kind = kind;
+        headers[node].data = nodes.size() - 1;
+    }
+
+    // nodes are added after the nodes they refer to, so walking the indices
+    // upwards always visits the operands of a node first
+    size_t size() const {
+        return headers.size();
+    }
+
+    tokenKind kind(node_index node) const {
+        return headers[node].kind;
+    }
+
+    int line(node_index node) const {
+        return headers[node].line;
+    }
+
+    // copies a run of indices to the end of lists, nested lists are made
+    // first so the items of one list always stay contiguous
+    node_list list(const std::vector<uint32_t> &items) {
+        node_list run{uint32_t(lists.size()), uint32_t(items.size())};
+        lists.insert(lists.end(), items.begin(), items.end());
+        return run;
+    }
+
+    std::span<const uint32_t> items(node_list run) const {
+        return std::span<const uint32_t>(lists.data() + run.begin, run.size);
+    }
+
+    string_index intern(std::string_view text) {
+        auto found = string_indices.find(text);
+        if (found != string_indices.end()) {
+            return found->second;
+        }
+
+        strings.emplace_back(text);
+        string_index index = strings.size() - 1;
+        string_indices[strings.back()] = index;
+        return index;
+    }
+
+    const std::string &text(string_index index) const {
+        return strings[index];
+    }
+
+    // the text of an identifier or literal, empty for every other node
+    const std::string &value(node_index node) const {
+        switch (kind(node)) {
+        case tokenKind::Identifier:
+            return text(get<identifier_node>(node).name);
+        case tokenKind::NumberLiteral:
+        case tokenKind::StringLiteral:
+        case tokenKind::BooleanLiteral:
+        case tokenKind::Keyword:
+            return text(get<literal_node>(node).value);
+        default:
+            return text(empty_string);
+        }
+    }
+
+  private:
+    std::vector<ast_node> headers;
+    std::vector<uint32_t> lists;
+    // a deque so the views in string_indices stay valid as it grows
+    std::deque<std::string> strings;
+    std::unordered_map<std::string_view, string_index> string_indices;
+    std::tuple<std::vector<identifier_node>,
+        std::vector<literal_node>,
+        std::vector<binary_node>,
+        std::vector<unary_node>,
+        std::vector<variable_node>,
+        std::vector<function_node>,
+        std::vector<call_node>,
+        std::vector<member_node>,
+        std::vector<object_node>,
+        std::vector<if_node>,
+        std::vector<while_node>,
+        std::vector<for_node>,
+        std::vector<import_node>,
+        std::vector<extern_node>>
+        pools;
+
+    template <typename T> std::vector<T> &pool() {
+        return std::get<std::vector<T>>(pools);
+    }
+
+    template <typename T> const std::vector<T> &pool() const {
+        return std::get<std::vector<T>>(pools);
+    }
+};
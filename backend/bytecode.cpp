@@ -0,0 +1,958 @@
+#include "bytecode.hpp"
+#include "debugger.hpp"
+#include <string>
+
+constexpr uint16_t no_register = 0xffff;
+
+[[noreturn]] static void compile_error(
+    const std::string &file_name, int line, const std::string &message) {
+    error(error_type::parsing_error, "", file_name, line, message);
+    exit(1);
+}
+
+// true when the expression reads all of its operands before writing the
+// target register, so it can be compiled straight into a live local
+static bool writes_target_last(tokenKind kind) {
+    switch (kind) {
+    case tokenKind::Identifier:
+    case tokenKind::NumberLiteral:
+    case tokenKind::StringLiteral:
+    case tokenKind::BooleanLiteral:
+    case tokenKind::BinaryExpr:
+    case tokenKind::ComparisonExpr:
+    case tokenKind::UnaryExpr:
+    case tokenKind::MemberExpr:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t bytecode_compiler::emit(op_code op, uint16_t a, uint16_t b, uint16_t c) {
+    current->proto->code.push_back(
+        instruction{.op = op, .a = a, .b = b, .c = c});
+    current->proto->lines.push_back(line);
+    current->proto->caches.emplace_back();
+    return current->proto->code.size() - 1;
+}
+
+size_t bytecode_compiler::emit_bx(op_code op, uint16_t a, uint32_t bx) {
+    return emit(op, a, uint16_t(bx & 0xffff), uint16_t(bx >> 16));
+}
+
+size_t bytecode_compiler::emit_jump(op_code op, uint16_t a) {
+    return emit_bx(op, a, 0);
+}
+
+void bytecode_compiler::patch_jump(size_t at, size_t target) {
+    uint32_t offset = uint32_t(int32_t(target) - int32_t(at + 1));
+    current->proto->code[at].b = uint16_t(offset & 0xffff);
+    current->proto->code[at].c = uint16_t(offset >> 16);
+}
+
+void bytecode_compiler::patch_jump(size_t at) {
+    patch_jump(at, current->proto->code.size());
+}
+
+uint16_t bytecode_compiler::reserve() {
+    uint16_t reg = current->free_register++;
+
+    if (current->free_register >= max_registers) {
+        compile_error(current->proto->file_name,
+            line,
+            "Function needs too many registers!");
+    }
+
+    if (current->free_register > current->proto->register_count) {
+        current->proto->register_count = current->free_register;
+    }
+
+    return reg;
+}
+
+void bytecode_compiler::free_to(uint16_t reg) {
+    current->free_register = reg;
+}
+
+uint32_t bytecode_compiler::number_constant(double number) {
+    auto found = current->number_constants.find(number);
+    if (found != current->number_constants.end()) {
+        return found->second;
+    }
+
+    gem_value value = gem_value::number(number);
+
+    uint32_t index = current->proto->constants.size();
+    current->proto->constants.push_back(value);
+    current->number_constants[number] = index;
+
+    return index;
+}
+
+uint32_t bytecode_compiler::string_constant(const std::string &string) {
+    auto found = current->string_constants.find(string);
+    if (found != current->string_constants.end()) {
+        return found->second;
+    }
+
+    gem_value value = make_string(string);
+
+    uint32_t index = current->proto->constants.size();
+    current->proto->constants.push_back(value);
+    current->string_constants[string] = index;
+
+    return index;
+}
+
+// globals are resolved once to their slot in the global scope, the map nodes
+// never move so the vm can load them with a single indirection
+uint32_t bytecode_compiler::global_index(const std::string &name) {
+    auto found = current->global_indices.find(name);
+    if (found != current->global_indices.end()) {
+        return found->second;
+    }
+
+    uint32_t index = current->proto->globals.size();
+    auto slot = global_scope->stack.try_emplace(name, gem_value::empty());
+    current->proto->globals.push_back(&slot.first->second);
+    current->global_indices[name] = index;
+
+    return index;
+}
+
+void bytecode_compiler::begin_block() {
+    current->depth++;
+}
+
+// pops the locals of the innermost block and returns the lowest register that
+// was captured by a closure, or -1 when nothing has to be closed
+int bytecode_compiler::end_block() {
+    current->depth--;
+    int close_from = -1;
+
+    while (!current->locals.empty() &&
+           current->locals.back().depth > current->depth) {
+        if (current->locals.back().captured) {
+            close_from = current->locals.back().reg;
+        }
+        current->locals.pop_back();
+    }
+
+    free_to(current->locals.empty() ? 0 : current->locals.back().reg + 1);
+    return close_from;
+}
+
+uint16_t bytecode_compiler::declare_local(const std::string &name) {
+    uint16_t reg = reserve();
+    current->locals.push_back(
+        local_variable{.name = name, .reg = reg, .depth = current->depth});
+    return reg;
+}
+
+// the local of the innermost block with the given name
+int bytecode_compiler::block_local(const std::string &name) {
+    int local = find_local(current, name);
+    return local >= 0 && current->locals[local].depth == current->depth
+               ? local
+               : -1;
+}
+
+// ifs do not open a block, like in the resolver of the tree-walker. the
+// locals their bodies declare are declared before the condition, so they
+// are null when their branch does not run and stay visible after the if
+void bytecode_compiler::hoist_if_locals(if_node &node) {
+    hoist_locals(node.body);
+    for (node_index elif : tree->items(node.elifs)) {
+        hoist_locals(tree->get<if_node>(elif).body);
+    }
+    hoist_locals(node.else_body);
+}
+
+void bytecode_compiler::hoist_locals(node_list body) {
+    for (node_index node : tree->items(body)) {
+        string_index name = empty_string;
+
+        if (tree->kind(node) == tokenKind::VariableDeclaration) {
+            name = tree->get<variable_node>(node).name;
+        } else if (tree->kind(node) == tokenKind::FunctionDeclaration) {
+            name = tree->get<function_node>(node).name;
+        } else if (tree->kind(node) == tokenKind::IfStmt) {
+            hoist_if_locals(tree->get<if_node>(node));
+        }
+
+        if (name != empty_string && block_local(tree->text(name)) < 0) {
+            emit(op_code::load_null, declare_local(tree->text(name)));
+        }
+    }
+}
+
+uint16_t bytecode_compiler::local_top() {
+    return current->locals.empty() ? 0 : current->locals.back().reg + 1;
+}
+
+int bytecode_compiler::find_local(function_state *state, const std::string &name) {
+    for (int index = int(state->locals.size()) - 1; index >= 0; --index) {
+        if (state->locals[index].name == name) {
+            return index;
+        }
+    }
+
+    return -1;
+}
+
+int bytecode_compiler::add_upvalue(
+    function_state *state, bool in_stack, uint16_t index) {
+    auto &upvalues = state->proto->upvalues;
+
+    for (size_t i = 0; i < upvalues.size(); ++i) {
+        if (upvalues[i].in_stack == in_stack && upvalues[i].index == index) {
+            return i;
+        }
+    }
+
+    upvalues.push_back(upvalue_info{.in_stack = in_stack, .index = index});
+    return upvalues.size() - 1;
+}
+
+int bytecode_compiler::resolve_upvalue(
+    function_state *state, const std::string &name) {
+    if (state->enclosing == nullptr) {
+        return -1;
+    }
+
+    int local = find_local(state->enclosing, name);
+    if (local >= 0) {
+        state->enclosing->locals[local].captured = true;
+        return add_upvalue(state, true, state->enclosing->locals[local].reg);
+    }
+
+    int upvalue = resolve_upvalue(state->enclosing, name);
+    if (upvalue >= 0) {
+        return add_upvalue(state, false, upvalue);
+    }
+
+    return -1;
+}
+
+gem_proto *bytecode_compiler::compile(ast &program, scope *globals) {
+    global_scope = globals;
+    tree = &program;
+
+    gem_proto *proto = new gem_proto;
+    proto->name = "main chunk";
+    proto->file_name = globals->file_name;
+
+    if (gem_protos.empty()) {
+        gc_roots.push_back(mark_protos);
+    }
+    gem_protos.push_back(proto);
+
+    function_state state{.proto = proto};
+    current = &state;
+
+    for (node_index node : program.items(program.body)) {
+        statement(node);
+    }
+
+    emit(op_code::ret);
+    current = nullptr;
+    tree = nullptr;
+
+    return proto;
+}
+
+// statements
+
+void bytecode_compiler::statement(node_index node) {
+    if (tree->line(node) != 0) {
+        line = tree->line(node);
+    }
+
+    switch (tree->kind(node)) {
+    case tokenKind::VariableDeclaration:
+        var_declaration(tree->get<variable_node>(node));
+        break;
+    case tokenKind::FunctionDeclaration:
+        function_declaration(node);
+        break;
+    case tokenKind::IfStmt:
+        if_statement(tree->get<if_node>(node));
+        break;
+    case tokenKind::WhileLoopStmt:
+        while_loop(tree->get<while_node>(node));
+        break;
+    case tokenKind::ForLoopStmt:
+        for_loop(node);
+        break;
+    case tokenKind::Keyword:
+        keyword(node);
+        break;
+    case tokenKind::ReturnStmt:
+        return_statement(tree->get<unary_node>(node));
+        break;
+    case tokenKind::AssignmentExpr:
+        assignment(node, no_register);
+        break;
+    default: {
+        uint16_t mark = current->free_register;
+        expression(node, reserve());
+        free_to(mark);
+        break;
+    }
+    }
+}
+
+void bytecode_compiler::var_declaration(variable_node &node) {
+    const std::string &name = tree->text(node.name);
+
+    if (current->enclosing == nullptr && current->depth == 0) {
+        uint16_t mark = current->free_register;
+        uint16_t reg = expression_any(node.value);
+        emit_bx(op_code::define_global, reg, global_index(name));
+        free_to(mark);
+        return;
+    }
+
+    // declaring a local of the block again assigns to it, closures that
+    // captured it see the new value as in the tree-walker
+    int local = block_local(name);
+    if (local >= 0) {
+        uint16_t reg = current->locals[local].reg;
+        uint16_t mark = current->free_register;
+
+        if (writes_target_last(tree->kind(node.value))) {
+            expression(node.value, reg);
+        } else {
+            uint16_t temporary = reserve();
+            expression(node.value, temporary);
+            emit(op_code::move, reg, temporary);
+        }
+
+        free_to(mark);
+        return;
+    }
+
+    // the register is claimed before the local becomes visible so that
+    // var x = x still reads the outer x
+    uint16_t reg = reserve();
+    expression(node.value, reg);
+    current->locals.push_back(
+        local_variable{.name = name, .reg = reg, .depth = current->depth});
+}
+
+gem_proto *bytecode_compiler::function_body(function_node &node) {
+    gem_proto *proto = new gem_proto;
+    proto->name =
+        node.name == empty_string ? "anonymous" : tree->text(node.name);
+    proto->file_name = global_scope->file_name;
+    proto->param_count = node.params.size;
+
+    // attached to the parent before compiling so the constants stay rooted
+    current->proto->protos.push_back(proto);
+
+    function_state state{.proto = proto, .enclosing = current};
+    current = &state;
+    int saved_line = line;
+
+    for (string_index param : tree->items(node.params)) {
+        declare_local(tree->text(param));
+    }
+
+    for (node_index statement_node : tree->items(node.body)) {
+        statement(statement_node);
+    }
+
+    emit(op_code::ret);
+
+    current = state.enclosing;
+    line = saved_line;
+
+    return proto;
+}
+
+void bytecode_compiler::function_declaration(node_index index) {
+    function_node &node = tree->get<function_node>(index);
+
+    if (node.name == empty_string) {
+        uint16_t mark = current->free_register;
+        expression(index, reserve());
+        free_to(mark);
+        return;
+    }
+
+    const std::string &name = tree->text(node.name);
+
+    if (current->enclosing == nullptr && current->depth == 0) {
+        uint16_t mark = current->free_register;
+        uint16_t reg = reserve();
+        function_body(node);
+        emit_bx(op_code::closure, reg, current->proto->protos.size() - 1);
+        emit_bx(op_code::define_global, reg, global_index(name));
+        free_to(mark);
+        return;
+    }
+
+    // declared before the body is compiled so the function can call itself
+    int local = block_local(name);
+    uint16_t reg =
+        local >= 0 ? current->locals[local].reg : declare_local(name);
+    function_body(node);
+    emit_bx(op_code::closure, reg, current->proto->protos.size() - 1);
+}
+
+void bytecode_compiler::if_statement(if_node &node) {
+    std::vector<size_t> exits;
+
+    if (current->enclosing != nullptr || current->depth > 0) {
+        hoist_if_locals(node);
+    }
+
+    auto branch = [&](if_node &branch_node, bool has_more) {
+        uint16_t mark = current->free_register;
+        uint16_t condition = expression_any(branch_node.condition);
+        size_t skip = emit_jump(op_code::jump_if_false, condition);
+        free_to(mark);
+
+        for (node_index statement_node : tree->items(branch_node.body)) {
+            statement(statement_node);
+        }
+
+        if (has_more) {
+            exits.push_back(emit_jump(op_code::jump));
+        }
+        patch_jump(skip);
+    };
+
+    auto elifs = tree->items(node.elifs);
+    bool has_else = node.else_body.size > 0;
+    branch(node, elifs.size() > 0 || has_else);
+
+    for (size_t index = 0; index < elifs.size(); ++index) {
+        branch(tree->get<if_node>(elifs[index]),
+            index + 1 < elifs.size() || has_else);
+    }
+
+    for (node_index statement_node : tree->items(node.else_body)) {
+        statement(statement_node);
+    }
+
+    for (size_t exit : exits) {
+        patch_jump(exit);
+    }
+}
+
+// the locals of a loop body are shared by every iteration, like the slots
+// of the tree-walker. they are declared before the loop starts, so nothing
+// else uses their registers, and closed once the loop is done
+void bytecode_compiler::while_loop(while_node &node) {
+    current->loops.push_back(loop_state{});
+    begin_block();
+    hoist_locals(node.body);
+
+    size_t loop_start = current->proto->code.size();
+
+    uint16_t mark = current->free_register;
+    uint16_t condition = expression_any(node.condition);
+    size_t exit = emit_jump(op_code::jump_if_false, condition);
+    free_to(mark);
+
+    for (node_index statement_node : tree->items(node.body)) {
+        statement(statement_node);
+    }
+
+    loop_state loop = std::move(current->loops.back());
+    current->loops.pop_back();
+
+    for (size_t jump : loop.continues) {
+        patch_jump(jump);
+    }
+    patch_jump(emit_jump(op_code::jump), loop_start);
+
+    patch_jump(exit);
+    for (size_t jump : loop.breaks) {
+        patch_jump(jump);
+    }
+
+    int close_from = end_block();
+    if (close_from >= 0) {
+        emit(op_code::close_upvalues, close_from);
+    }
+}
+
+void bytecode_compiler::for_loop(node_index index) {
+    for_node &node = tree->get<for_node>(index);
+
+    auto iterator = tree->items(node.range);
+
+    if (iterator.size() < 2) {
+        compile_error(current->proto->file_name,
+            tree->line(index),
+            "Missing iterator in for loop declaration!");
+    }
+
+    if (node.params.size == 0) {
+        compile_error(current->proto->file_name,
+            tree->line(index),
+            "Missing variable in for loop declaration!");
+    }
+
+    // hidden locals: index, limit, step, followed by the visible variable
+    current->loops.push_back(loop_state{});
+    begin_block();
+    uint16_t base = declare_local("(for index)");
+    expression(iterator[0], base);
+    expression(iterator[1], declare_local("(for limit)"));
+
+    uint16_t step = declare_local("(for step)");
+    if (iterator.size() > 2) {
+        expression(iterator[2], step);
+    } else {
+        emit_bx(op_code::load_const, step, number_constant(1));
+    }
+
+    declare_local(tree->text(tree->items(node.params)[0]));
+    hoist_locals(node.body);
+
+    size_t prep = emit_jump(op_code::for_prep, base);
+    size_t body_start = current->proto->code.size();
+
+    for (node_index statement_node : tree->items(node.body)) {
+        statement(statement_node);
+    }
+
+    loop_state loop = std::move(current->loops.back());
+    current->loops.pop_back();
+
+    for (size_t jump : loop.continues) {
+        patch_jump(jump);
+    }
+    patch_jump(emit_jump(op_code::for_loop, base), body_start);
+
+    patch_jump(prep);
+    for (size_t jump : loop.breaks) {
+        patch_jump(jump);
+    }
+
+    int close_from = end_block();
+    if (close_from >= 0) {
+        emit(op_code::close_upvalues, close_from);
+    }
+}
+
+void bytecode_compiler::keyword(node_index node) {
+    const std::string &value = tree->value(node);
+
+    if (value != "break" && value != "continue") {
+        error(error_type::parsing_error,
+            add_pointers("~", value, 0, value.size()),
+            current->proto->file_name,
+            tree->line(node),
+            "Invalid keyword!");
+        exit(1);
+    }
+
+    if (current->loops.empty()) {
+        compile_error(current->proto->file_name,
+            tree->line(node),
+            "Cannot use '" + value + "' outside of a loop!");
+    }
+
+    size_t jump = emit_jump(op_code::jump);
+
+    if (value == "break") {
+        current->loops.back().breaks.push_back(jump);
+    } else {
+        current->loops.back().continues.push_back(jump);
+    }
+}
+
+void bytecode_compiler::return_statement(unary_node &node) {
+    uint16_t mark = current->free_register;
+    emit(op_code::ret, expression_any(node.right), 1);
+    free_to(mark);
+}
+
+// expressions
+
+void bytecode_compiler::expression(node_index node, uint16_t target) {
+    if (tree->line(node) != 0) {
+        line = tree->line(node);
+    }
+
+    switch (tree->kind(node)) {
+    case tokenKind::Identifier:
+        identifier(tree->value(node), target);
+        break;
+    case tokenKind::NumberLiteral:
+        emit_bx(op_code::load_const,
+            target,
+            number_constant(tree->get<literal_node>(node).number));
+        break;
+    case tokenKind::StringLiteral:
+        emit_bx(op_code::load_const, target, string_constant(tree->value(node)));
+        break;
+    case tokenKind::BooleanLiteral:
+        emit(op_code::load_bool, target, tree->value(node) == "false" ? 0 : 1);
+        break;
+    case tokenKind::AssignmentExpr:
+        assignment(node, target);
+        break;
+    case tokenKind::BinaryExpr:
+        binary_operation(node, target);
+        break;
+    case tokenKind::ComparisonExpr:
+        comparison(node, target);
+        break;
+    case tokenKind::LogicGateExpr:
+        logic_gate(tree->get<binary_node>(node), target);
+        break;
+    case tokenKind::UnaryExpr:
+        unary(node, target);
+        break;
+    case tokenKind::CallExpr:
+        call(node, target);
+        break;
+    case tokenKind::MemberExpr:
+        member_expression(node, target);
+        break;
+    case tokenKind::ObjectLiteral:
+        table_expression(tree->get<object_node>(node), target);
+        break;
+    case tokenKind::FunctionDeclaration:
+        function_body(tree->get<function_node>(node));
+        emit_bx(op_code::closure, target, current->proto->protos.size() - 1);
+        break;
+    default:
+        error(error_type::parsing_error,
+            std::string(magic_enum::enum_name(tree->kind(node))),
+            current->proto->file_name,
+            tree->line(node),
+            "Invalid AST!");
+        exit(1);
+    }
+}
+
+uint16_t bytecode_compiler::expression_any(node_index node) {
+    if (tree->kind(node) == tokenKind::Identifier) {
+        int local = find_local(current, tree->value(node));
+        if (local >= 0) {
+            return current->locals[local].reg;
+        }
+    }
+
+    uint16_t reg = reserve();
+    expression(node, reg);
+    return reg;
+}
+
+uint16_t bytecode_compiler::expression_rk(node_index node) {
+    uint32_t constant = rk_constant;
+
+    if (tree->kind(node) == tokenKind::NumberLiteral) {
+        constant = number_constant(tree->get<literal_node>(node).number);
+    } else if (tree->kind(node) == tokenKind::StringLiteral) {
+        constant = string_constant(tree->value(node));
+    }
+
+    if (constant < rk_constant) {
+        return uint16_t(constant) | rk_constant;
+    }
+
+    return expression_any(node);
+}
+
+void bytecode_compiler::identifier(const std::string &name, uint16_t target) {
+    int local = find_local(current, name);
+    if (local >= 0) {
+        if (current->locals[local].reg != target) {
+            emit(op_code::move, target, current->locals[local].reg);
+        }
+        return;
+    }
+
+    int upvalue = resolve_upvalue(current, name);
+    if (upvalue >= 0) {
+        emit(op_code::get_upvalue, target, upvalue);
+        return;
+    }
+
+    emit_bx(op_code::get_global, target, global_index(name));
+}
+
+void bytecode_compiler::assignment(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    binary_node &node = tree->get<binary_node>(index);
+
+    if (tree->kind(node.left) == tokenKind::MemberExpr) {
+        member_node &left = tree->get<member_node>(node.left);
+        uint16_t object = expression_any(left.object);
+        uint16_t key = member_key_rk(left);
+        uint16_t value;
+
+        if (target != no_register) {
+            expression(node.right, target);
+            value = target;
+        } else {
+            value = expression_rk(node.right);
+        }
+
+        emit(op_code::set_index, object, key, value);
+        free_to(mark);
+        return;
+    }
+
+    if (tree->kind(node.left) != tokenKind::Identifier) {
+        compile_error(current->proto->file_name,
+            tree->line(index),
+            "Invalid assignment target!");
+    }
+
+    const std::string &name = tree->value(node.left);
+    int local = find_local(current, name);
+    if (local >= 0) {
+        uint16_t reg = current->locals[local].reg;
+
+        if (writes_target_last(tree->kind(node.right))) {
+            expression(node.right, reg);
+        } else {
+            uint16_t temporary = reserve();
+            expression(node.right, temporary);
+            emit(op_code::move, reg, temporary);
+        }
+
+        if (target != no_register && target != reg) {
+            emit(op_code::move, target, reg);
+        }
+
+        free_to(mark);
+        return;
+    }
+
+    uint16_t value = target != no_register ? target : reserve();
+    expression(node.right, value);
+
+    int upvalue = resolve_upvalue(current, name);
+    if (upvalue >= 0) {
+        emit(op_code::set_upvalue, value, upvalue);
+    } else {
+        emit_bx(op_code::set_global, value, global_index(name));
+    }
+
+    free_to(mark);
+}
+
+void bytecode_compiler::binary_operation(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    binary_node &node = tree->get<binary_node>(index);
+    const std::string &name = tree->text(node.op);
+    uint16_t left = expression_rk(node.left);
+    uint16_t right = expression_rk(node.right);
+
+    op_code op;
+    if (name == "+")
+        op = op_code::add;
+    else if (name == "-")
+        op = op_code::sub;
+    else if (name == "*")
+        op = op_code::mul;
+    else if (name == "/")
+        op = op_code::div;
+    else if (name == "%")
+        op = op_code::mod;
+    else if (name == "^")
+        op = op_code::pow;
+    else
+        compile_error(current->proto->file_name,
+            tree->line(index),
+            "Invalid binary operator '" + name + "'!");
+
+    line = tree->line(index);
+    emit(op, target, left, right);
+    free_to(mark);
+}
+
+void bytecode_compiler::comparison(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    binary_node &node = tree->get<binary_node>(index);
+    const std::string &name = tree->text(node.op);
+    uint16_t left = expression_rk(node.left);
+    uint16_t right = expression_rk(node.right);
+
+    op_code op;
+    if (name == "==")
+        op = op_code::eq;
+    else if (name == "!=")
+        op = op_code::ne;
+    else if (name == "<")
+        op = op_code::lt;
+    else if (name == "<=")
+        op = op_code::le;
+    else if (name == ">")
+        op = op_code::gt;
+    else if (name == ">=")
+        op = op_code::ge;
+    else
+        compile_error(current->proto->file_name,
+            tree->line(index),
+            "Invalid comparison operator '" + name + "'!");
+
+    line = tree->line(index);
+    emit(op, target, left, right);
+    free_to(mark);
+}
+
+void bytecode_compiler::logic_gate(binary_node &node, uint16_t target) {
+    expression(node.left, target);
+    size_t skip = emit_jump(tree->text(node.op) == "and"
+                                ? op_code::jump_if_false
+                                : op_code::jump_if_true,
+        target);
+    expression(node.right, target);
+    patch_jump(skip);
+}
+
+void bytecode_compiler::unary(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    unary_node &node = tree->get<unary_node>(index);
+    const std::string &op = tree->text(node.op);
+    uint16_t value = expression_any(node.right);
+
+    line = tree->line(index);
+    if (op == "-") {
+        emit(op_code::neg, target, value);
+    } else if (op == "!") {
+        emit(op_code::not_, target, value);
+    } else {
+        error(error_type::parsing_error,
+            add_pointers("^", op + "x", 0, 0),
+            current->proto->file_name,
+            tree->line(index),
+            "Invalid unary expression!");
+        exit(1);
+    }
+
+    free_to(mark);
+}
+
+void bytecode_compiler::call(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    call_node &node = tree->get<call_node>(index);
+
+    // a temporary at the top of the stack can hold the function directly
+    uint16_t base = target == current->free_register - 1 && target >= local_top()
+                        ? target
+                        : reserve();
+    uint16_t argument_count = node.args.size;
+    bool self_call = tree->kind(node.caller) == tokenKind::MemberExpr;
+
+    if (self_call) {
+        member_node &caller = tree->get<member_node>(node.caller);
+        uint16_t self = reserve();
+        uint16_t object = expression_any(caller.object);
+        uint32_t key = caller.computed
+                           ? rk_constant
+                           : string_constant(tree->value(caller.property));
+
+        line = tree->line(index);
+        if (key < rk_constant) {
+            emit(op_code::self, base, object, key);
+        } else {
+            emit(op_code::move, self, object);
+            emit(op_code::get_index, base, object, member_key_rk(caller));
+        }
+
+        free_to(self + 1);
+        argument_count++;
+    } else {
+        expression(node.caller, base);
+    }
+
+    for (node_index argument : tree->items(node.args)) {
+        expression(argument, reserve());
+    }
+
+    line = tree->line(index);
+    emit(op_code::call, base, argument_count, self_call ? 1 : 0);
+
+    if (base != target) {
+        emit(op_code::move, target, base);
+    }
+
+    free_to(mark);
+}
+
+uint16_t bytecode_compiler::member_key_rk(member_node &node) {
+    if (node.computed) {
+        return expression_rk(node.property);
+    }
+
+    uint32_t key = string_constant(tree->value(node.property));
+    if (key < rk_constant) {
+        return uint16_t(key) | rk_constant;
+    }
+
+    uint16_t reg = reserve();
+    emit_bx(op_code::load_const, reg, key);
+    return reg;
+}
+
+void bytecode_compiler::member_expression(node_index index, uint16_t target) {
+    uint16_t mark = current->free_register;
+    member_node &node = tree->get<member_node>(index);
+    uint16_t object = expression_any(node.object);
+    uint16_t key = member_key_rk(node);
+
+    line = tree->line(index);
+    if (!node.computed && (key & rk_constant)) {
+        emit(op_code::get_field, target, object, key & ~rk_constant);
+    } else {
+        emit(op_code::get_index, target, object, key);
+    }
+
+    free_to(mark);
+}
+
+void bytecode_compiler::table_expression(object_node &node, uint16_t target) {
+    emit(op_code::new_table, target);
+
+    auto properties = tree->items(node.properties);
+    for (size_t index = 0; index < properties.size(); index += 2) {
+        uint16_t mark = current->free_register;
+        node_index key_node = properties[index];
+        uint16_t key;
+
+        if (tree->kind(key_node) == tokenKind::Identifier) {
+            uint32_t constant = string_constant(tree->value(key_node));
+            if (constant < rk_constant) {
+                key = uint16_t(constant) | rk_constant;
+            } else {
+                key = reserve();
+                emit_bx(op_code::load_const, key, constant);
+            }
+        } else {
+            key = expression_rk(key_node);
+        }
+
+        uint16_t value = expression_rk(properties[index + 1]);
+        emit(op_code::set_index, target, key, value);
+        free_to(mark);
+    }
+}
+
+// GC
+
+static void mark_proto(gem_proto *proto) {
+    for (gem_value constant : proto->constants) {
+        mark_value(constant);
+    }
+
+    for (gem_proto *child : proto->protos) {
+        mark_proto(child);
+    }
+}
+
+void mark_protos() {
+    for (gem_proto *proto : gem_protos) {
+        mark_proto(proto);
+    }
+}
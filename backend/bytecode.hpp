@@ -0,0 +1,178 @@
+#pragma once
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// register based bytecode, every instruction is 8 bytes.
+// R(x) is register x of the current frame, K(x) is constant x and RK(x) is a
+// constant when the rk_constant bit is set, otherwise a register.
+enum class op_code : uint8_t {
+    load_const,     // R(a) = K(bx)
+    load_null,      // R(a) = null
+    load_bool,      // R(a) = b != 0
+    move,           // R(a) = R(b)
+    get_global,     // R(a) = globals[bx]
+    define_global,  // globals[bx] = R(a)
+    set_global,     // globals[bx] = R(a), must already exist
+    get_upvalue,    // R(a) = upvalues[b]
+    set_upvalue,    // upvalues[b] = R(a)
+    close_upvalues, // close every open upvalue >= R(a)
+    closure,        // R(a) = closure(protos[bx])
+    new_table,      // R(a) = {}
+    get_field,      // R(a) = R(b)[K(c)], K(c) is a string
+    get_index,      // R(a) = R(b)[RK(c)]
+    set_index,      // R(a)[RK(b)] = RK(c)
+    self,           // R(a + 1) = R(b); R(a) = R(b)[K(c)]
+    add,            // R(a) = RK(b) + RK(c)
+    sub,
+    mul,
+    div,
+    mod,
+    pow,
+    eq,             // R(a) = RK(b) == RK(c)
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+    neg,            // R(a) = -R(b)
+    not_,           // R(a) = !R(b)
+    jump,           // pc += sbx
+    jump_if_false,  // if not R(a) then pc += sbx
+    jump_if_true,   // if R(a) then pc += sbx
+    for_prep,       // check R(a)..R(a + 2), if R(a) >= R(a + 1) then pc += sbx
+    for_loop,       // R(a) += R(a + 2), if R(a) < R(a + 1) then pc += sbx
+    call,           // R(a) = R(a)(R(a + 1) .. R(a + b)), c = 1 for self calls
+    ret,            // return b == 0 ? null : R(a)
+};
+
+constexpr uint16_t rk_constant = 0x8000;
+constexpr uint16_t max_registers = rk_constant - 1;
+
+struct instruction {
+    op_code op;
+    uint8_t unused = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    uint32_t bx() const {
+        return uint32_t(b) | (uint32_t(c) << 16);
+    }
+
+    int32_t sbx() const {
+        return int32_t(bx());
+    }
+};
+
+static_assert(sizeof(instruction) == 8);
+
+struct gem_proto {
+    std::string name;
+    std::string file_name;
+    std::vector<instruction> code;
+    std::vector<int> lines;
+    // inline caches of get_field and self, one per instruction like lines
+    std::vector<member_cache> caches;
+    std::vector<gem_value> constants;
+    std::vector<gem_value *> globals;
+    std::vector<gem_proto *> protos;
+    std::vector<upvalue_info> upvalues;
+    uint16_t param_count = 0;
+    uint16_t register_count = 0;
+
+    ~gem_proto() {
+        for (gem_proto *proto : protos) {
+            delete proto;
+        }
+    }
+};
+
+class bytecode_compiler {
+  public:
+    gem_proto *compile(ast &program, scope *globals);
+
+  private:
+    struct local_variable {
+        std::string name;
+        uint16_t reg;
+        int depth;
+        bool captured = false;
+    };
+
+    struct loop_state {
+        std::vector<size_t> breaks;
+        std::vector<size_t> continues;
+    };
+
+    struct function_state {
+        gem_proto *proto;
+        function_state *enclosing = nullptr;
+        std::vector<local_variable> locals{};
+        std::vector<loop_state> loops{};
+        std::unordered_map<std::string, uint32_t> global_indices{};
+        std::unordered_map<double, uint32_t> number_constants{};
+        std::unordered_map<std::string, uint32_t> string_constants{};
+        int depth = 0;
+        uint16_t free_register = 0;
+    };
+
+    function_state *current = nullptr;
+    scope *global_scope = nullptr;
+    ast *tree = nullptr;
+    int line = 0;
+
+    size_t emit(op_code op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+    size_t emit_bx(op_code op, uint16_t a, uint32_t bx);
+    size_t emit_jump(op_code op, uint16_t a = 0);
+    void patch_jump(size_t at, size_t target);
+    void patch_jump(size_t at);
+
+    uint16_t reserve();
+    void free_to(uint16_t reg);
+    uint32_t number_constant(double value);
+    uint32_t string_constant(const std::string &value);
+    uint32_t global_index(const std::string &name);
+
+    void begin_block();
+    int end_block();
+    uint16_t declare_local(const std::string &name);
+    int block_local(const std::string &name);
+    void hoist_if_locals(if_node &node);
+    void hoist_locals(node_list body);
+    uint16_t local_top();
+    int find_local(function_state *state, const std::string &name);
+    int resolve_upvalue(function_state *state, const std::string &name);
+    int add_upvalue(function_state *state, bool in_stack, uint16_t index);
+
+    void statement(node_index node);
+    void var_declaration(variable_node &node);
+    void function_declaration(node_index node);
+    gem_proto *function_body(function_node &node);
+    void if_statement(if_node &node);
+    void while_loop(while_node &node);
+    void for_loop(node_index node);
+    void keyword(node_index node);
+    void return_statement(unary_node &node);
+
+    void expression(node_index node, uint16_t target);
+    uint16_t expression_any(node_index node);
+    uint16_t expression_rk(node_index node);
+    void identifier(const std::string &name, uint16_t target);
+    void assignment(node_index node, uint16_t target);
+    void binary_operation(node_index node, uint16_t target);
+    void comparison(node_index node, uint16_t target);
+    void logic_gate(binary_node &node, uint16_t target);
+    void unary(node_index node, uint16_t target);
+    void call(node_index node, uint16_t target);
+    void member_expression(node_index node, uint16_t target);
+    void table_expression(object_node &node, uint16_t target);
+    uint16_t member_key_rk(member_node &node);
+};
+
+inline std::vector<gem_proto *> gem_protos;
+
+void mark_protos();
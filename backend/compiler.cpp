@@ -2,6 +2,7 @@
 #include "compiler.hpp"
 #include "../gemSettings.hpp"
 #include <algorithm>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -11,19 +12,34 @@
 #include <string>
 #include <unordered_map>
 #include <variant>
-tokenKind resolve_type(astToken &node, const std::string &side) {
-    if (side == "left") {
-        if (!node.left) {
-            return node.kind;
-        } else {
-            return resolve_type(*node.left, side);
-        }
+// the left or right operand of a node, no_node for nodes without one
+node_index operand(ast &tree, node_index node, const std::string &side) {
+    switch (tree.kind(node)) {
+    case tokenKind::BinaryExpr:
+    case tokenKind::ComparisonExpr:
+    case tokenKind::LogicGateExpr:
+    case tokenKind::AssignmentExpr: {
+        binary_node &binary = tree.get<binary_node>(node);
+        return side == "left" ? binary.left : binary.right;
+    }
+    case tokenKind::UnaryExpr:
+    case tokenKind::ReturnStmt:
+    case tokenKind::Export:
+        return side == "left" ? no_node : tree.get<unary_node>(node).right;
+    case tokenKind::VariableDeclaration:
+        return side == "left" ? no_node : tree.get<variable_node>(node).value;
+    default:
+        return no_node;
+    }
+}
+
+tokenKind resolve_type(ast &tree, node_index node, const std::string &side) {
+    node_index next = operand(tree, node, side);
+
+    if (next == no_node) {
+        return tree.kind(node);
     } else {
-        if (!node.right) {
-            return node.kind;
-        } else {
-            return resolve_type(*node.right, side);
-        }
+        return resolve_type(tree, next, side);
     }
 }
 
@@ -33,257 +49,831 @@ std::unordered_map<std::string, std::string> templates{
     {"string", "(gem_object_string*)"},
     {"number", "(gem_object_number)*"},
     {"new_number", "make_number({})"},
-    {"new_string", "make_string({})"},
     {"new_bool", "make_bool({})"}};
 
-void gem_compiler::code_gen_body(std::vector<std::shared_ptr<astToken>> body) {
+void gem_compiler::code_gen_body(node_list body) {
     std::vector<std::string> stored_pointers;
 
-    for (std::shared_ptr<astToken> &token : body) {
-        std::optional<std::string> variable = gem_compiler::code_gen(*token);
+    // captured functions get their cell before any function of the body is
+    // made, so they can capture themselves and each other
+    for (node_index token : tree->items(body)) {
+        if (tree->kind(token) != tokenKind::FunctionDeclaration) {
+            continue;
+        }
+
+        const std::string &name =
+            tree->text(tree->get<function_node>(token).name);
+        if (cell_locals.count(name)) {
+            *gem_compiler::out << templates["object"] << " " << name
+                               << " = make_cell(make_nil());\n"
+                               << "gem_retain(" << name << ");\n";
+        }
+    }
+
+    for (node_index token : tree->items(body)) {
+        std::optional<std::string> variable = gem_compiler::code_gen(token);
+        if (tree->kind(token) == tokenKind::CallExpr) {
+            *gem_compiler::out << ";\n";
+        }
 
         if (variable.has_value()) {
             stored_pointers.push_back(variable.value());
+            live_objects.push_back(variable.value());
         }
     }
 
     *gem_compiler::out << "\n";
 
     for (std::string &ptr : stored_pointers) {
-        *gem_compiler::out << ptr << "->references--;\n";
-        *gem_compiler::out << string_format("gem_check_free({})", ptr) << ";\n";
+        *gem_compiler::out << "gem_release(" << ptr << ");\n";
+        live_objects.pop_back();
+    }
+    if (!stored_pointers.empty()) {
+        *gem_compiler::out << "gem_zct_release(zct_mark);\n";
     }
 }
 
-void gem_compiler::code_gen_program(astToken &node) {
-    gem_compiler::code_gen_body(node.body);
+// statements that only work on number locals never make temporaries
+bool gem_compiler::allocates(node_index node) {
+    switch (tree->kind(node)) {
+    case tokenKind::VariableDeclaration:
+        return !number_locals.count(
+            tree->text(tree->get<variable_node>(node).name));
+    case tokenKind::AssignmentExpr: {
+        node_index left = tree->get<binary_node>(node).left;
+        return tree->kind(left) != tokenKind::Identifier ||
+               !number_locals.count(tree->value(left));
+    }
+    default:
+        return true;
+    }
+}
+
+// temporaries are freed in batches across iterations instead of after
+// every statement, loops that only work on number locals skip it
+void gem_compiler::code_gen_loop_release(
+    node_index condition, node_list body) {
+    auto statements = tree->items(body);
+    bool release = std::any_of(statements.begin(),
+        statements.end(),
+        [&](node_index statement) { return allocates(statement); });
+
+    if (release || (condition != no_node &&
+                       !gem_compiler::is_number_comparison(condition))) {
+        *gem_compiler::out << "gem_zct_step(zct_mark);\n";
+    }
+}
+
+void gem_compiler::code_gen_program(ast &program) {
+    gem_compiler::code_gen_body(program.body);
+}
+
+void gem_compiler::code_gen_number(node_index node) {
+    *gem_compiler::out << string_format(
+        templates["new_number"], tree->value(node));
+}
+
+void gem_compiler::code_gen_bool(node_index node) {
+    *gem_compiler::out << string_format(templates["new_bool"], tree->value(node));
+}
+
+// gem strings can be quoted with ', ` or " and span lines, escapes are
+// the same as in C
+std::string c_string_literal(const std::string &text) {
+    std::string literal = "\"";
+
+    for (size_t i = 1; i + 1 < text.size(); ++i) {
+        if (text[i] == '\\' && i + 2 < text.size()) {
+            literal += text.substr(i++, 2);
+        } else if (text[i] == '"') {
+            literal += "\\\"";
+        } else if (text[i] == '\n') {
+            literal += "\\n";
+        } else {
+            literal += text[i];
+        }
+    }
+
+    return literal + "\"";
+}
+
+// literals are static objects the runtime never frees, evaluating one does
+// not allocate
+void gem_compiler::code_gen_string(node_index node) {
+    std::string text = c_string_literal(tree->value(node));
+    auto [literal, inserted] = string_literals.try_emplace(
+        text, "gem_string_literal_" + std::to_string(string_literals.size()));
+
+    if (inserted) {
+        string_literal_order.push_back(text);
+    }
+    *gem_compiler::out << "(gem_object *)&" << literal->second;
+}
+
+// a number as a C double literal
+std::string number_literal(double number) {
+    if (std::isinf(number)) {
+        return "INFINITY";
+    }
+
+    std::string text = string_format("{}", number);
+    if (text.find_first_of(".e") == std::string::npos) {
+        text += ".0";
+    }
+    return text;
+}
+
+// literals, number locals and arithmetic on them
+bool gem_compiler::is_number_expression(node_index node) {
+    switch (tree->kind(node)) {
+    case tokenKind::NumberLiteral:
+        return true;
+    case tokenKind::Identifier:
+        return number_locals.count(tree->value(node)) > 0;
+    case tokenKind::BinaryExpr: {
+        binary_node &binary = tree->get<binary_node>(node);
+        return is_number_expression(binary.left) &&
+               is_number_expression(binary.right);
+    }
+    default:
+        return false;
+    }
+}
+
+// the double of a number expression, nothing is allocated
+void gem_compiler::code_gen_number_expression(node_index node) {
+    switch (tree->kind(node)) {
+    case tokenKind::NumberLiteral:
+        *gem_compiler::out << number_literal(
+            tree->get<literal_node>(node).number);
+        break;
+    case tokenKind::Identifier:
+        *gem_compiler::out << tree->value(node);
+        break;
+    case tokenKind::BinaryExpr: {
+        binary_node &binary = tree->get<binary_node>(node);
+        const std::string &op = tree->text(binary.op);
+
+        if (op == "^" || op == "%") {
+            *gem_compiler::out << (op == "^" ? "pow(" : "fmod(");
+            gem_compiler::code_gen_number_expression(binary.left);
+            *gem_compiler::out << ", ";
+            gem_compiler::code_gen_number_expression(binary.right);
+            *gem_compiler::out << ")";
+        } else {
+            *gem_compiler::out << "(";
+            gem_compiler::code_gen_number_expression(binary.left);
+            *gem_compiler::out << " " << op << " ";
+            gem_compiler::code_gen_number_expression(binary.right);
+            *gem_compiler::out << ")";
+        }
+        break;
+    }
+    default:
+        break;
+    }
 }
 
-void gem_compiler::code_gen_number(astToken &node) {
-    *gem_compiler::out << string_format(templates["new_number"], node.value);
+// a double for any expression, values that are not known to be numbers are
+// checked by the runtime
+void gem_compiler::code_gen_unboxed(node_index node) {
+    if (gem_compiler::is_number_expression(node)) {
+        gem_compiler::code_gen_number_expression(node);
+    } else {
+        *gem_compiler::out << "gem_to_number(st, ";
+        gem_compiler::code_gen(node);
+        *gem_compiler::out << ")";
+    }
 }
 
-void gem_compiler::code_gen_bool(astToken &node) {
-    *gem_compiler::out << string_format(templates["new_bool"], node.value);
+bool gem_compiler::is_number_comparison(node_index node) {
+    if (tree->kind(node) != tokenKind::ComparisonExpr) {
+        return false;
+    }
+
+    binary_node &binary = tree->get<binary_node>(node);
+    return gem_compiler::is_number_expression(binary.left) &&
+           gem_compiler::is_number_expression(binary.right);
 }
 
-void gem_compiler::code_gen_string(astToken &node) {
-    *gem_compiler::out << string_format(templates["new_string"], node.value);
+// comparisons of numbers become plain C comparisons, everything else is
+// tested by the runtime
+void gem_compiler::code_gen_condition(node_index node) {
+    if (gem_compiler::is_number_comparison(node)) {
+        binary_node &binary = tree->get<binary_node>(node);
+        *gem_compiler::out << "(";
+        gem_compiler::code_gen_number_expression(binary.left);
+        *gem_compiler::out << " " << tree->text(binary.op) << " ";
+        gem_compiler::code_gen_number_expression(binary.right);
+        *gem_compiler::out << ")";
+        return;
+    }
+
+    *gem_compiler::out << "isTruthy(";
+    gem_compiler::code_gen(node);
+    *gem_compiler::out << ")";
 }
 
-std::string gem_compiler::code_gen_var_decl(astToken &node) {
-    *gem_compiler::out << templates["object"] << " " << node.name << " = ";
-    gem_compiler::code_gen(*node.right);
-    *gem_compiler::out << ";\n" << node.name << "->references++;\n";
+std::optional<std::string> gem_compiler::code_gen_var_decl(
+    variable_node &node) {
+    const std::string &name = tree->text(node.name);
+
+    if (number_locals.count(name)) {
+        *gem_compiler::out << "double " << name << " = ";
+        gem_compiler::code_gen_number_expression(node.value);
+        *gem_compiler::out << ";\n";
+        return std::nullopt;
+    }
+
+    *gem_compiler::out << templates["object"] << " " << name << " = ";
+    if (cell_locals.count(name)) {
+        *gem_compiler::out << "make_cell(";
+        gem_compiler::code_gen(node.value);
+        *gem_compiler::out << ")";
+    } else {
+        gem_compiler::code_gen(node.value);
+    }
+    *gem_compiler::out << ";\ngem_retain(" << name << ");\n";
 
-    return node.name;
+    return name;
 }
 
-void gem_compiler::code_gen_binaryoperation(astToken &node) {
-    if (node.op == "+") {
+void gem_compiler::code_gen_binaryoperation(binary_node &node) {
+    const std::string &op = tree->text(node.op);
+    if (op == "+") {
         *gem_compiler::out << "gem_add";
-    } else if (node.op == "-") {
+    } else if (op == "-") {
         *gem_compiler::out << "number_sub";
-    } else if (node.op == "*") {
+    } else if (op == "*") {
         *gem_compiler::out << "number_mul";
-    } else if (node.op == "/") {
+    } else if (op == "/") {
         *gem_compiler::out << "number_div";
-    } else if (node.op == "^") {
+    } else if (op == "^") {
         *gem_compiler::out << "number_pow";
-    } else if (node.op == "%") {
+    } else if (op == "%") {
         *gem_compiler::out << "number_mod";
     }
     *gem_compiler::out << "(st, ";
-    gem_compiler::code_gen(*node.left);
+    gem_compiler::code_gen(node.left);
     *gem_compiler::out << ", ";
-    gem_compiler::code_gen(*node.right);
+    gem_compiler::code_gen(node.right);
     *gem_compiler::out << ")";
 }
 
-void gem_compiler::code_gen_assignmentexpr(astToken &node) {
-    gem_compiler::code_gen(*node.left);
+void gem_compiler::code_gen_assignmentexpr(binary_node &node) {
+    if (tree->kind(node.left) == tokenKind::Identifier &&
+        number_locals.count(tree->value(node.left))) {
+        *gem_compiler::out << tree->value(node.left) << " = ";
+        gem_compiler::code_gen_number_expression(node.right);
+        *gem_compiler::out << ";\n";
+        return;
+    }
+
+    if (tree->kind(node.left) == tokenKind::Identifier &&
+        cell_locals.count(tree->value(node.left))) {
+        *gem_compiler::out << "gem_cell_set(" << tree->value(node.left)
+                           << ", ";
+        gem_compiler::code_gen(node.right);
+        *gem_compiler::out << ");\n";
+        return;
+    }
+
+    gem_compiler::code_gen(node.left);
     *gem_compiler::out << " = ";
     *gem_compiler::out << "gem_assign(";
-    gem_compiler::code_gen(*node.left);
+    gem_compiler::code_gen(node.left);
     *gem_compiler::out << ", ";
-    gem_compiler::code_gen(*node.right);
+    gem_compiler::code_gen(node.right);
     *gem_compiler::out << ");\n";
 }
 
-void gem_compiler::code_gen_conditionals(astToken &node) {
-    if (node.op == "==") {
-        *gem_compiler::out << "gem_equal(st, ";
-        gem_compiler::code_gen(*node.left);
-        *gem_compiler::out << ", ";
-        gem_compiler::code_gen(*node.right);
-        *gem_compiler::out << ")";
-    } else if (node.op == "!=") {
-        *gem_compiler::out << "gem_notEqual(st, ";
-        gem_compiler::code_gen(*node.left);
-        *gem_compiler::out << ", ";
-        gem_compiler::code_gen(*node.right);
+void gem_compiler::code_gen_conditionals(binary_node &node) {
+    const std::string &op = tree->text(node.op);
+    if (gem_compiler::is_number_expression(node.left) &&
+        gem_compiler::is_number_expression(node.right)) {
+        *gem_compiler::out << "make_bool(";
+        gem_compiler::code_gen_number_expression(node.left);
+        *gem_compiler::out << " " << op << " ";
+        gem_compiler::code_gen_number_expression(node.right);
         *gem_compiler::out << ")";
+        return;
     }
+
+    if (op == "==") {
+        *gem_compiler::out << "gem_equal";
+    } else if (op == "!=") {
+        *gem_compiler::out << "gem_notEqual";
+    } else if (op == "<") {
+        *gem_compiler::out << "number_lessThan";
+    } else if (op == ">") {
+        *gem_compiler::out << "number_greaterThan";
+    } else if (op == "<=") {
+        *gem_compiler::out << "number_lessThanEqual";
+    } else if (op == ">=") {
+        *gem_compiler::out << "number_greaterThanEqual";
+    }
+    *gem_compiler::out << "(st, ";
+    gem_compiler::code_gen(node.left);
+    *gem_compiler::out << ", ";
+    gem_compiler::code_gen(node.right);
+    *gem_compiler::out << ")";
 }
 
-void gem_compiler::code_gen_ifstmt(astToken &node) {
+void gem_compiler::code_gen_ifstmt(if_node &node) {
     *gem_compiler::out << "if (";
-    gem_compiler::code_gen(*node.left);
+    gem_compiler::code_gen_condition(node.condition);
     *gem_compiler::out << ") {\n";
 
     gem_compiler::code_gen_body(node.body);
 
     *gem_compiler::out << "}\n";
 
-    if (node.elifChain.size() > 0) {
-        for (auto &elif : node.elifChain) {
+    if (node.elifs.size > 0) {
+        for (node_index elif : tree->items(node.elifs)) {
+            if_node &branch = tree->get<if_node>(elif);
             *gem_compiler::out << "else if (";
-            gem_compiler::code_gen(*elif->left);
+            gem_compiler::code_gen_condition(branch.condition);
             *gem_compiler::out << ") {\n";
-            gem_compiler::code_gen_body(elif->body);
+            gem_compiler::code_gen_body(branch.body);
             *gem_compiler::out << "}\n";
         }
     }
 
-    if (node.elseBody.size() > 0) {
+    if (node.else_body.size > 0) {
         *gem_compiler::out << "else {\n";
 
-        gem_compiler::code_gen_body(node.elseBody);
+        gem_compiler::code_gen_body(node.else_body);
 
         *gem_compiler::out << "}\n";
     }
 }
 
-void gem_compiler::code_gen_forloop(astToken &node) {
-    if (std::holds_alternative<std::vector<std::shared_ptr<astToken>>>(
-            node.iterator)) {
-        auto iterator =
-            std::get<std::vector<std::shared_ptr<astToken>>>(node.iterator);
-        *gem_compiler::out << "for (" << templates["object"] << node.params[0]
-                           << "=";
-        gem_compiler::code_gen(*iterator[0]);
-        *gem_compiler::out << "; ";
-        *gem_compiler::out << "number_lessThan(";
-        *gem_compiler::out << node.params[0] << ", ";
-        gem_compiler::code_gen(*iterator[1]);
-        *gem_compiler::out << "); " << node.params[0] << "+=";
+void gem_compiler::code_gen_forloop(for_node &node) {
+    // like the interpreter the counter is a double of its own and the loop
+    // variable gets a copy of it on every iteration
+    auto range = tree->items(node.range);
+    const std::string &variable = tree->text(tree->items(node.params)[0]);
+    std::string index = "for_index" + std::to_string(++loop_count);
+    std::string end = "for_end" + std::to_string(loop_count);
+    std::string step = "for_step" + std::to_string(loop_count);
+
+    *gem_compiler::out << "for (double " << index << " = ";
+    gem_compiler::code_gen_unboxed(range[0]);
+    *gem_compiler::out << ", " << end << " = ";
+    gem_compiler::code_gen_unboxed(range[1]);
+    *gem_compiler::out << ", " << step << " = ";
+    if (range.size() > 2) {
+        gem_compiler::code_gen_unboxed(range[2]);
+    } else {
+        *gem_compiler::out << "1.0";
+    }
+    *gem_compiler::out << "; " << index << " < " << end << "; " << index
+                       << " += " << step << ") {\n";
+
+    bool boxed = !number_locals.count(variable);
+    if (boxed) {
+        std::string value = "make_number(" + index + ")";
+        if (cell_locals.count(variable)) {
+            value = "make_cell(" + value + ")";
+        }
+        *gem_compiler::out << templates["object"] << " " << variable << " = "
+                           << value << ";\ngem_retain(" << variable
+                           << ");\n";
+        live_objects.push_back(variable);
+    } else {
+        *gem_compiler::out << "double " << variable << " = " << index
+                           << ";\n";
+    }
+    gem_compiler::code_gen_loop_release(no_node, node.body);
+
+    gem_compiler::code_gen_body(node.body);
+
+    if (boxed) {
+        *gem_compiler::out << "gem_release(" << variable << ");\n";
+        live_objects.pop_back();
     }
+    *gem_compiler::out << "}\n";
+}
 
+void gem_compiler::code_gen_whileloop(while_node &node) {
+    *gem_compiler::out << "while (";
+    gem_compiler::code_gen_condition(node.condition);
     *gem_compiler::out << ") {\n";
 
+    gem_compiler::code_gen_loop_release(node.condition, node.body);
+
     gem_compiler::code_gen_body(node.body);
 
     *gem_compiler::out << "}\n";
 }
 
+// the values a variable is given in one function and whether it is declared
+// there or belongs to an enclosing function
+struct local_values {
+    bool declared = false;
+    std::vector<node_index> values;
+};
+
+using function_locals = std::unordered_map<std::string, local_values>;
+
+void collect_local_values(ast &tree,
+    node_index node,
+    function_locals &locals,
+    std::unordered_set<std::string> &captured);
+
+void collect_local_values_in_body(ast &tree,
+    node_list body,
+    function_locals &locals,
+    std::unordered_set<std::string> &captured);
+
 void search_for_identifiers_in_node(
-    astToken &node, std::vector<std::string> &container);
+    ast &tree, node_index node, std::vector<std::string> &container);
 
 void search_for_identifiers_in_body(
-    std::vector<std::shared_ptr<astToken>> &body,
-    std::vector<std::string> &container) {
-    for (auto &node : body) {
-        search_for_identifiers_in_node(*node, container);
+    ast &tree, node_list body, std::vector<std::string> &container) {
+    for (node_index node : tree.items(body)) {
+        search_for_identifiers_in_node(tree, node, container);
     }
 }
 
 void search_for_identifiers_in_node(
-    astToken &node, std::vector<std::string> &container) {
+    ast &tree, node_index node, std::vector<std::string> &container) {
 
-    switch (node.kind) {
+    switch (tree.kind(node)) {
     case tokenKind::Identifier:
-        container.push_back(node.value);
+        container.push_back(tree.value(node));
         break;
     case tokenKind::ForLoopStmt: {
-        if (std::holds_alternative<std::shared_ptr<astToken>>(node.iterator)) {
-            auto ptr = std::get<std::shared_ptr<astToken>>(node.iterator);
-            search_for_identifiers_in_node(*ptr, container);
-        } else {
-            auto ptr =
-                std::get<std::vector<std::shared_ptr<astToken>>>(node.iterator);
-            search_for_identifiers_in_body(ptr, container);
+        for_node &loop = tree.get<for_node>(node);
+        search_for_identifiers_in_body(tree, loop.range, container);
+        search_for_identifiers_in_body(tree, loop.body, container);
+
+        break;
+    }
+    case tokenKind::ObjectLiteral: {
+        auto properties = tree.items(tree.get<object_node>(node).properties);
+        for (size_t index = 1; index < properties.size(); index += 2) {
+            search_for_identifiers_in_node(tree, properties[index], container);
+        }
+        break;
+    }
+    case tokenKind::IfStmt: {
+        if_node &branch = tree.get<if_node>(node);
+        search_for_identifiers_in_node(tree, branch.condition, container);
+        search_for_identifiers_in_body(tree, branch.body, container);
+        search_for_identifiers_in_body(tree, branch.else_body, container);
+        search_for_identifiers_in_body(tree, branch.elifs, container);
+        break;
+    }
+    case tokenKind::WhileLoopStmt: {
+        while_node &loop = tree.get<while_node>(node);
+        search_for_identifiers_in_node(tree, loop.condition, container);
+        search_for_identifiers_in_body(tree, loop.body, container);
+        break;
+    }
+    case tokenKind::FunctionDeclaration: {
+        // only the variables a function does not declare anywhere in its
+        // body, loops and blocks included, come from outside of it
+        function_node &function = tree.get<function_node>(node);
+        std::vector<std::string> used;
+        search_for_identifiers_in_body(tree, function.body, used);
+
+        function_locals locals;
+        std::unordered_set<std::string> captured;
+        collect_local_values_in_body(tree, function.body, locals, captured);
+        for (string_index param : tree.items(function.params)) {
+            locals[tree.text(param)].declared = true;
+        }
+
+        for (std::string &name : used) {
+            auto local = locals.find(name);
+            if (local == locals.end() || !local->second.declared) {
+                container.push_back(name);
+            }
+        }
+        break;
+    }
+    case tokenKind::CallExpr: {
+        call_node &call = tree.get<call_node>(node);
+        search_for_identifiers_in_node(tree, call.caller, container);
+        search_for_identifiers_in_body(tree, call.args, container);
+        break;
+    }
+    case tokenKind::MemberExpr: {
+        member_node &member = tree.get<member_node>(node);
+        search_for_identifiers_in_node(tree, member.object, container);
+        search_for_identifiers_in_node(tree, member.property, container);
+        break;
+    }
+    default:
+        for (const char *side : {"left", "right"}) {
+            node_index next = operand(tree, node, side);
+            if (next != no_node) {
+                search_for_identifiers_in_node(tree, next, container);
+            }
         }
-        search_for_identifiers_in_body(node.body, container);
 
         break;
     }
+}
+
+void collect_local_values_in_body(ast &tree,
+    node_list body,
+    function_locals &locals,
+    std::unordered_set<std::string> &captured) {
+    for (node_index node : tree.items(body)) {
+        collect_local_values(tree, node, locals, captured);
+    }
+}
+
+// every value the locals of one function are given by declarations and
+// assignments. the counters of numerical for loops are declared without a
+// value, they are always numbers. nested functions are not walked into, the
+// variables they use are captured
+void collect_local_values(ast &tree,
+    node_index node,
+    function_locals &locals,
+    std::unordered_set<std::string> &captured) {
+    switch (tree.kind(node)) {
+    case tokenKind::VariableDeclaration: {
+        variable_node &variable = tree.get<variable_node>(node);
+        local_values &local = locals[tree.text(variable.name)];
+        local.declared = true;
+        local.values.push_back(variable.value);
+        collect_local_values(tree, variable.value, locals, captured);
+        break;
+    }
+    case tokenKind::AssignmentExpr: {
+        binary_node &assignment = tree.get<binary_node>(node);
+        if (tree.kind(assignment.left) == tokenKind::Identifier) {
+            locals[tree.value(assignment.left)].values.push_back(
+                assignment.right);
+        }
+        collect_local_values(tree, assignment.right, locals, captured);
+        break;
+    }
+    case tokenKind::FunctionDeclaration: {
+        function_node &function = tree.get<function_node>(node);
+        local_values &local = locals[tree.text(function.name)];
+        local.declared = true;
+        local.values.push_back(node);
+
+        std::vector<std::string> container;
+        search_for_identifiers_in_node(tree, node, container);
+        captured.insert(container.begin(), container.end());
+
+        // what the nested function assigns to variables it does not declare
+        // is assigned to the variables here
+        function_locals nested;
+        std::unordered_set<std::string> nested_captured;
+        collect_local_values_in_body(
+            tree, function.body, nested, nested_captured);
+        for (string_index param : tree.items(function.params)) {
+            nested.erase(tree.text(param));
+        }
+        for (auto &[name, nested_local] : nested) {
+            if (!nested_local.declared) {
+                std::vector<node_index> &values = locals[name].values;
+                values.insert(values.end(),
+                    nested_local.values.begin(),
+                    nested_local.values.end());
+            }
+        }
+        break;
+    }
+    case tokenKind::ForLoopStmt: {
+        for_node &loop = tree.get<for_node>(node);
+        if (loop.params.size > 0) {
+            locals[tree.text(tree.items(loop.params)[0])].declared = true;
+        }
+        collect_local_values_in_body(tree, loop.range, locals, captured);
+        collect_local_values_in_body(tree, loop.body, locals, captured);
+        break;
+    }
+    case tokenKind::IfStmt: {
+        if_node &branch = tree.get<if_node>(node);
+        collect_local_values(tree, branch.condition, locals, captured);
+        collect_local_values_in_body(tree, branch.body, locals, captured);
+        collect_local_values_in_body(tree, branch.elifs, locals, captured);
+        collect_local_values_in_body(tree, branch.else_body, locals, captured);
+        break;
+    }
+    case tokenKind::WhileLoopStmt: {
+        while_node &loop = tree.get<while_node>(node);
+        collect_local_values(tree, loop.condition, locals, captured);
+        collect_local_values_in_body(tree, loop.body, locals, captured);
+        break;
+    }
+    case tokenKind::CallExpr: {
+        call_node &call = tree.get<call_node>(node);
+        collect_local_values(tree, call.caller, locals, captured);
+        collect_local_values_in_body(tree, call.args, locals, captured);
+        break;
+    }
+    case tokenKind::MemberExpr: {
+        member_node &member = tree.get<member_node>(node);
+        collect_local_values(tree, member.object, locals, captured);
+        collect_local_values(tree, member.property, locals, captured);
+        break;
+    }
     case tokenKind::ObjectLiteral: {
-        for (auto &prop : node.properties) {
-            search_for_identifiers_in_node(*prop.value, container);
+        auto properties = tree.items(tree.get<object_node>(node).properties);
+        for (size_t index = 1; index < properties.size(); index += 2) {
+            collect_local_values(tree, properties[index], locals, captured);
         }
         break;
     }
     default:
-        if (node.left) {
-            search_for_identifiers_in_node(*node.left, container);
+        for (const char *side : {"left", "right"}) {
+            node_index next = operand(tree, node, side);
+            if (next != no_node) {
+                collect_local_values(tree, next, locals, captured);
+            }
         }
-        if (node.right) {
-            search_for_identifiers_in_node(*node.right, container);
+        break;
+    }
+}
+
+// a local is a number when every value it is given is a number expression,
+// starting from every local and dropping the ones that are given anything
+// else until no more are dropped. parameters, variables of enclosing
+// functions and locals that nested functions capture stay objects, the
+// captured ones live in cells. functions that are only ever given their
+// declaration are called directly
+void gem_compiler::infer_locals(node_list params, node_list body) {
+    function_locals locals;
+    std::unordered_set<std::string> captured;
+    collect_local_values_in_body(*tree, body, locals, captured);
+
+    number_locals.clear();
+    cell_locals.clear();
+    assigned_params.clear();
+    for (auto &[name, local] : locals) {
+        if (!local.declared) {
+            continue;
         }
-        if (node.caller) {
-            search_for_identifiers_in_node(*node.caller, container);
+
+        // locals shadow the functions of enclosing functions
+        static_functions.erase(name);
+        if (local.values.size() == 1 &&
+            tree->kind(local.values[0]) == tokenKind::FunctionDeclaration) {
+            static_functions[name] = local.values[0];
         }
-        if (node.object) {
-            search_for_identifiers_in_node(*node.object, container);
+
+        if (captured.count(name)) {
+            cell_locals.insert(name);
+        } else {
+            number_locals.insert(name);
         }
-        if (node.property) {
-            search_for_identifiers_in_node(*node.property, container);
+    }
+    for (string_index param : tree->items(params)) {
+        number_locals.erase(tree->text(param));
+        static_functions.erase(tree->text(param));
+        if (captured.count(tree->text(param))) {
+            cell_locals.insert(tree->text(param));
+        } else if (!locals[tree->text(param)].values.empty()) {
+            assigned_params.insert(tree->text(param));
         }
-        search_for_identifiers_in_body(node.body, container);
-        search_for_identifiers_in_body(node.elseBody, container);
-        search_for_identifiers_in_body(node.elifChain, container);
-        search_for_identifiers_in_body(node.args, container);
+    }
 
-        break;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (auto name = number_locals.begin(); name != number_locals.end();) {
+            std::vector<node_index> &values = locals[*name].values;
+            bool numbers = std::all_of(values.begin(),
+                values.end(),
+                [&](node_index value) { return is_number_expression(value); });
+
+            if (numbers) {
+                ++name;
+            } else {
+                name = number_locals.erase(name);
+                changed = true;
+            }
+        }
     }
 }
 
-std::optional<std::string> gem_compiler::code_gen_function(astToken &node) {
-    // enviroment copy
-    std::vector<std::string> declared_variables;
-    std::vector<std::string> internals;
-    std::vector<std::string> container;
+// a function that is only ever given its declaration is called as the C
+// function it compiles to, the arguments it is not given are nil. any
+// other callee is checked and given its arguments by the runtime
+void gem_compiler::code_gen_call(call_node &node) {
+    auto args = tree->items(node.args);
+    auto callee = tree->kind(node.caller) == tokenKind::Identifier
+                      ? static_functions.find(tree->value(node.caller))
+                      : static_functions.end();
+
+    if (callee != static_functions.end()) {
+        function_node &function = tree->get<function_node>(callee->second);
+
+        if (args.size() <= function.params.size) {
+            *gem_compiler::out << "gem_fn_" << tree->text(function.name)
+                               << "(st, gem_internals(";
+            gem_compiler::code_gen(node.caller);
+            *gem_compiler::out << ")";
 
-    for (auto &nested_variable : node.body) {
-        if (nested_variable->kind == tokenKind::VariableDeclaration) {
-            declared_variables.push_back(nested_variable->name);
+            for (node_index arg : args) {
+                *gem_compiler::out << ", ";
+                gem_compiler::code_gen(arg);
+            }
+            for (size_t i = args.size(); i < function.params.size; ++i) {
+                *gem_compiler::out << ", make_nil()";
+            }
+            *gem_compiler::out << ")";
+            return;
         }
     }
 
-    for (auto &nested_variable : node.params) {
-        declared_variables.push_back(nested_variable);
+    *gem_compiler::out << "gem_call_func(";
+    gem_compiler::code_gen(node.caller);
+    *gem_compiler::out << ", st, " << args.size() << ", ";
+
+    if (args.empty()) {
+        *gem_compiler::out << "NULL)";
+        return;
+    }
+
+    *gem_compiler::out << "(gem_object*[]){";
+    for (size_t i = 0; i < args.size(); ++i) {
+        *gem_compiler::out << (i > 0 ? ", " : "");
+        gem_compiler::code_gen(args[i]);
     }
+    *gem_compiler::out << "})";
+}
+
+std::optional<std::string> gem_compiler::code_gen_function(node_index function_at) {
+    function_node &node = tree->get<function_node>(function_at);
+    const std::string &name = tree->text(node.name);
+    int line = tree->line(function_at);
+    // enviroment copy, the variables the function uses but never declares
+    std::vector<std::string> internals;
+    std::vector<std::string> container;
 
-    search_for_identifiers_in_node(node, container);
+    search_for_identifiers_in_node(*tree, function_at, container);
 
     for (auto &identifier : container) {
-        if (std::find(declared_variables.begin(),
-                declared_variables.end(),
-                identifier) == declared_variables.end()) {
+        if (std::find(internals.begin(), internals.end(), identifier) ==
+            internals.end()) {
             internals.push_back(identifier);
         }
     }
 
-    std::string fnName = node.name + "_inner_internals";
-    *gem_compiler::out << "gem_object** " << fnName
-                       << " = "
-                          "malloc(sizeof(gem_object*) * "
-                       << internals.size() << ");\n";
+    // the body declared the cell of a captured function up front
+    bool captured = cell_locals.count(name) > 0;
+
+    std::string fnName = name + "_inner_internals";
+    if (!internals.empty()) {
+        *gem_compiler::out << "gem_object** " << fnName
+                           << " = "
+                              "malloc(sizeof(gem_object*) * "
+                           << internals.size() << ");\n";
+    }
     int index = 0;
 
+    // the function shares the cells of the variables it captures, values
+    // that are not in a cell get one of their own
     for (std::string &internal : internals) {
-        *gem_compiler::out << fnName << "[" << index << "] = copy_object("
-                           << internal << ");\n"
-                           << fnName << "[" << index << "]->references++;\n";
+        std::string cell = cell_locals.count(internal)
+                               ? internal
+                               : "make_cell(" + internal + ")";
+        *gem_compiler::out << fnName << "[" << index << "] = " << cell
+                           << ";\n"
+                           << "gem_retain(" << fnName << "[" << index
+                           << "]);\n";
         index++;
     }
     // declare it
     gem_compiler::make_stream();
+    std::unordered_set<std::string> enclosing_number_locals =
+        std::move(number_locals);
+    std::unordered_set<std::string> enclosing_cell_locals =
+        std::move(cell_locals);
+    std::vector<std::string> enclosing_live_objects = std::move(live_objects);
+    live_objects.clear();
+    std::unordered_map<std::string, node_index> enclosing_static_functions =
+        static_functions;
+    std::unordered_set<std::string> enclosing_assigned_params =
+        std::move(assigned_params);
+    gem_compiler::infer_locals(node.params, node.body);
+    cell_locals.insert(internals.begin(), internals.end());
 
-    *gem_compiler::out
-        << templates["object"] << node.name
-        << "(stack_trace* st, gem_object** internals, gem_object** "
-           "arguments) {\n";
+    // the arguments are C parameters, calls that can not see the function
+    // go through an entry that takes them as an array
+    std::string params;
+    std::string arguments;
+    int param_index = 0;
+    for (string_index param : tree->items(node.params)) {
+        params += ", gem_object* " + tree->text(param);
+        arguments += ", arguments[" + std::to_string(param_index++) + "]";
+    }
+
+    std::string signature = templates["object"] + " gem_fn_" + name +
+                            "(stack_trace* st, gem_object** internals" +
+                            params + ")";
+    function_prototypes.push_back(signature + ";");
+    *gem_compiler::out << signature << " {\n";
     /*st->FileName = "main.gem";
 
     gem_object* index = make_number(20);
@@ -303,10 +893,11 @@ std::optional<std::string> gem_compiler::code_gen_function(astToken &node) {
 
     *gem_compiler::out << "st->FileName = \"" << gem_compiler::file_name
                        << "\";\n";
-    *gem_compiler::out << "st->Line = " << node.line << ";"
-                       << "trace_add_trace(st, " << node.line
-                       << ", \"in function <" << node.name << "> \", false, \""
-                       << gem_compiler::file_name << "\");\n";
+    *gem_compiler::out << "st->Line = " << line << ";"
+                       << "trace_add_trace(st, " << line
+                       << ", \"in function <" << name << "> \", false, \""
+                       << gem_compiler::file_name << "\");\n"
+                       << "size_t zct_mark = gem_zct_mark();\n";
     /*	gem_object* index = internals[0];
     st->FileName = "main.gem";
 
@@ -327,30 +918,71 @@ std::optional<std::string> gem_compiler::code_gen_function(astToken &node) {
         internal_index++;
     }
 
+    // the caller holds on to the arguments until the call is done, only
+    // parameters that are assigned need a reference of their own, captured
+    // ones are moved into a cell the nested functions share
+    for (string_index param : tree->items(node.params)) {
+        const std::string &name = tree->text(param);
+        if (cell_locals.count(name)) {
+            *gem_compiler::out << name << " = make_cell(" << name << ");\n"
+                               << "gem_retain(" << name << ");\n";
+            live_objects.push_back(name);
+        } else if (assigned_params.count(name)) {
+            *gem_compiler::out << "gem_retain(" << name << ");\n";
+            live_objects.push_back(name);
+        }
+    }
+
     gem_compiler::code_gen_body(node.body);
+    for (auto local = live_objects.rbegin(); local != live_objects.rend();
+         ++local) {
+        *gem_compiler::out << "gem_release(" << *local << ");\n";
+    }
     *gem_compiler::out << "back(st);\n";
-    *gem_compiler::out << "\nreturn make_nil();\n};";
+    *gem_compiler::out << "\nreturn make_nil();\n};\n";
+    *gem_compiler::out << templates["object"] << "gem_entry_" << name
+                       << "(stack_trace* st, gem_object** internals, "
+                          "gem_object** arguments) {\n"
+                       << "return gem_fn_" << name << "(st, internals"
+                       << arguments << ");\n};";
     std::string function = (*gem_compiler::out).str();
 
     gem_compiler::free_stream();
+    number_locals = std::move(enclosing_number_locals);
+    cell_locals = std::move(enclosing_cell_locals);
+    live_objects = std::move(enclosing_live_objects);
+    static_functions = std::move(enclosing_static_functions);
+    assigned_params = std::move(enclosing_assigned_params);
     gem_compiler::add_header(function);
     //	gem_object* func_inner = make_function(func_inner_internals, 1,
     // iterator_nest_1, 0);
-    *gem_compiler::out << templates["object"] << " " << node.name
-                       << " = make_function("
-                       << (internals.size() > 0 ? fnName : "NULL") << ", "
-                       << internals.size() << ", " << node.name << ", "
-                       << node.params.size() << ");\n";
-    return node.name;
+    std::string function_object = string_format("make_function({}, {}, {}, {})",
+        internals.size() > 0 ? fnName : "NULL",
+        internals.size(),
+        "gem_entry_" + name,
+        node.params.size);
+
+    if (captured) {
+        *gem_compiler::out << "gem_cell_set(" << name << ", "
+                           << function_object << ");\n";
+    } else {
+        *gem_compiler::out << templates["object"] << " " << name << " = "
+                           << function_object << ";\n"
+                           << "gem_retain(" << name << ");\n";
+    }
+    return name;
 }
 
-std::optional<std::string> gem_compiler::code_gen(astToken &node) {
-    switch (node.kind) {
-    case tokenKind::Program:
-        gem_compiler::code_gen_program(node);
-        break;
+std::optional<std::string> gem_compiler::code_gen(node_index node) {
+    switch (tree->kind(node)) {
     case tokenKind::Identifier:
-        *gem_compiler::out << node.value;
+        if (number_locals.count(tree->value(node))) {
+            *gem_compiler::out << "make_number(" << tree->value(node) << ")";
+        } else if (cell_locals.count(tree->value(node))) {
+            *gem_compiler::out << "gem_cell_get(" << tree->value(node) << ")";
+        } else {
+            *gem_compiler::out << tree->value(node);
+        }
         break;
     case tokenKind::NumberLiteral:
         gem_compiler::code_gen_number(node);
@@ -362,30 +994,56 @@ std::optional<std::string> gem_compiler::code_gen(astToken &node) {
         gem_compiler::code_gen_bool(node);
         break;
     case tokenKind::VariableDeclaration:
-        return gem_compiler::code_gen_var_decl(node);
+        return gem_compiler::code_gen_var_decl(tree->get<variable_node>(node));
     case tokenKind::BinaryExpr:
-        gem_compiler::code_gen_binaryoperation(node);
+        if (gem_compiler::is_number_expression(node)) {
+            *gem_compiler::out << "make_number(";
+            gem_compiler::code_gen_number_expression(node);
+            *gem_compiler::out << ")";
+        } else {
+            gem_compiler::code_gen_binaryoperation(
+                tree->get<binary_node>(node));
+        }
         break;
     case tokenKind::AssignmentExpr:
-        gem_compiler::code_gen_assignmentexpr(node);
+        gem_compiler::code_gen_assignmentexpr(tree->get<binary_node>(node));
         break;
     case tokenKind::ComparisonExpr:
-        gem_compiler::code_gen_conditionals(node);
+        gem_compiler::code_gen_conditionals(tree->get<binary_node>(node));
         break;
     case tokenKind::IfStmt:
-        gem_compiler::code_gen_ifstmt(node);
+        gem_compiler::code_gen_ifstmt(tree->get<if_node>(node));
         break;
     case tokenKind::ForLoopStmt:
-        gem_compiler::code_gen_forloop(node);
+        gem_compiler::code_gen_forloop(tree->get<for_node>(node));
         break;
-    case tokenKind::ReturnStmt:
-        *gem_compiler::out << "back(st);\n";
-        *gem_compiler::out << "return ";
-        gem_compiler::code_gen(*node.right);
-        *gem_compiler::out << ";\n";
+    case tokenKind::WhileLoopStmt:
+        gem_compiler::code_gen_whileloop(tree->get<while_node>(node));
+        break;
+    case tokenKind::ReturnStmt: {
+        // the value outlives the locals it may come from
+        node_index value = tree->get<unary_node>(node).right;
+        *gem_compiler::out << "{\ngem_object* return_value = ";
+        if (value != no_node) {
+            gem_compiler::code_gen(value);
+        } else {
+            *gem_compiler::out << "make_nil()";
+        }
+        *gem_compiler::out << ";\ngem_retain(return_value);\n";
+
+        for (auto local = live_objects.rbegin(); local != live_objects.rend();
+             ++local) {
+            *gem_compiler::out << "gem_release(" << *local << ");\n";
+        }
+        *gem_compiler::out << "back(st);\n"
+                           << "return gem_return(return_value, zct_mark);\n}\n";
         break;
+    }
     case tokenKind::FunctionDeclaration:
         return gem_compiler::code_gen_function(node);
+    case tokenKind::CallExpr:
+        gem_compiler::code_gen_call(tree->get<call_node>(node));
+        break;
     default:
         break;
     };
@@ -420,7 +1078,8 @@ void gem_compiler::add_header(const std::string &header) {
     *gem_compiler::out << header << "\n" << content;
 }
 
-std::string gem_compiler::compile(astToken &ast) {
+std::string gem_compiler::compile(ast &program) {
+    tree = &program;
     if (settings.verbose)
         std::cout << "Begining code compilation to C!" << std::endl;
     gem_compiler::make_stream();
@@ -428,12 +1087,28 @@ std::string gem_compiler::compile(astToken &ast) {
     *gem_compiler::out << "stack_trace* st = create_stack_trace();\n"
                        << "st->FileName = \"" << gem_compiler::file_name
                        << "\";\n"
-                       << "st->Line = " << ast.line << ";\n"
-                       << "trace_add_trace(st, " << ast.line
+                       << "st->Line = 0;\n"
+                       << "trace_add_trace(st, 0"
                        << ", \"in main chunk\", false, \""
-                       << gem_compiler::file_name << "\");\n";
-    gem_compiler::code_gen(ast);
-    *gem_compiler::out << "\nback(st);\ndestroy_stack(st);\n}";
+                       << gem_compiler::file_name << "\");\n"
+                       << "size_t zct_mark = gem_zct_mark();\n";
+    gem_compiler::infer_locals(node_list{}, program.body);
+    gem_compiler::code_gen_program(program);
+    *gem_compiler::out
+        << "\nback(st);\ngem_collect_garbage();\ndestroy_stack(st);\n}";
+
+    std::ostringstream prototypes;
+    for (const std::string &prototype : function_prototypes) {
+        prototypes << prototype << "\n";
+    }
+    gem_compiler::add_header(prototypes.str());
+
+    std::ostringstream literals;
+    for (const std::string &text : string_literal_order) {
+        literals << "gem_object_string " << string_literals[text]
+                 << " = GEM_STRING_LITERAL(" << text << ");\n";
+    }
+    gem_compiler::add_header(literals.str());
 
     gem_compiler::link("./backend/templates/runtime.c");
     if (settings.debug)
@@ -6,6 +6,8 @@
 #include <fmt/format.h>
 #include <filesystem>
 #include <optional>
+#include <unordered_map>
+#include <unordered_set>
 
 template<typename... Args>
 std::string string_format(const std::string &src, Args&&... args) {
@@ -17,23 +19,55 @@ class gem_compiler {
     std::vector<std::ostringstream> streams;
     std::ostringstream* out = nullptr;
     std::string file_name;
-    std::string compile(astToken &ast);
+    ast *tree = nullptr;
+    // locals of the function being compiled that only ever hold numbers,
+    // they are plain doubles in the generated C and only boxed where they
+    // are handed to the runtime
+    std::unordered_set<std::string> number_locals;
+    // locals that closures capture, they are held in cells
+    std::unordered_set<std::string> cell_locals;
+    // the object locals in scope, a return statement releases them
+    std::vector<std::string> live_objects;
+    // parameters the function being compiled assigns to
+    std::unordered_set<std::string> assigned_params;
+    // the declarations of the functions in scope that are never assigned,
+    // calls to them are direct C calls
+    std::unordered_map<std::string, node_index> static_functions;
+    int loop_count = 0;
+    // the static object of every distinct string literal, in the order they
+    // were first used
+    std::unordered_map<std::string, std::string> string_literals;
+    std::vector<std::string> string_literal_order;
+    // a prototype for every compiled function, they come before the bodies
+    // so functions can call each other in any order
+    std::vector<std::string> function_prototypes;
+    std::string compile(ast &program);
 
   public:
-    std::optional<std::string> code_gen(astToken &node);
-    void code_gen_program(astToken &node);
-    void code_gen_number(astToken &node);
-    void code_gen_bool(astToken &node);
-    void code_gen_string(astToken &node);
-    std::string code_gen_var_decl(astToken &node);
-    void code_gen_binaryoperation(astToken &node);
-    void code_gen_assignmentexpr(astToken &node);
-    void code_gen_conditionals(astToken &node);
-    void code_gen_ifstmt(astToken &node);
-    void code_gen_body(std::vector<std::shared_ptr<astToken>> body);
-    void code_gen_forloop(astToken &node);
+    std::optional<std::string> code_gen(node_index node);
+    void code_gen_program(ast &program);
+    void code_gen_number(node_index node);
+    void infer_locals(node_list params, node_list body);
+    bool is_number_expression(node_index node);
+    bool is_number_comparison(node_index node);
+    bool allocates(node_index node);
+    void code_gen_loop_release(node_index condition, node_list body);
+    void code_gen_number_expression(node_index node);
+    void code_gen_unboxed(node_index node);
+    void code_gen_condition(node_index node);
+    void code_gen_bool(node_index node);
+    void code_gen_string(node_index node);
+    std::optional<std::string> code_gen_var_decl(variable_node &node);
+    void code_gen_binaryoperation(binary_node &node);
+    void code_gen_assignmentexpr(binary_node &node);
+    void code_gen_conditionals(binary_node &node);
+    void code_gen_ifstmt(if_node &node);
+    void code_gen_body(node_list body);
+    void code_gen_forloop(for_node &node);
+    void code_gen_whileloop(while_node &node);
     void add_header(const std::string &header);
-    std::optional<std::string> code_gen_function(astToken &node);
+    std::optional<std::string> code_gen_function(node_index node);
+    void code_gen_call(call_node &node);
     void link(const std::string &c_file);
 
   public:
@@ -1,10 +1,12 @@
 #pragma once
+#include <algorithm>
 #include <format>
 #include <iostream>
 #include <sstream>
 #include <string>
 #include <string_view>
 #include <unordered_map>
+#include <vector>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -60,6 +62,52 @@ inline std::vector<std::string> split_by_width(const std::string& text, size_t w
     return lines;
 }
 
+// text of the lines of a source buffer by line number. the offsets of the
+// line starts are only computed the first time a line is asked for, which
+// only happens when an error is reported
+class line_index {
+  public:
+    line_index() = default;
+    explicit line_index(std::string_view source) : source(source) {}
+
+    size_t line_count() {
+        build();
+        return offsets.size();
+    }
+
+    // 1 based, lines past the end give the last line
+    std::string line(size_t number) {
+        build();
+        size_t index = std::min(std::max<size_t>(number, 1), offsets.size()) - 1;
+        size_t end = index + 1 < offsets.size() ? offsets[index + 1]
+                                                : source.size();
+
+        std::string_view text = source.substr(offsets[index], end - offsets[index]);
+        while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) {
+            text.remove_suffix(1);
+        }
+        return std::string(text);
+    }
+
+  private:
+    std::string_view source;
+    std::vector<size_t> offsets;
+
+    void build() {
+        if (!offsets.empty()) {
+            return;
+        }
+
+        offsets.push_back(0);
+        for (size_t index = 0; index < source.size(); index++) {
+            // a new line that ends the source does not start another line
+            if (source[index] == '\n' && index + 1 < source.size()) {
+                offsets.push_back(index + 1);
+            }
+        }
+    }
+};
+
 inline std::string add_pointers(const std::string pointer_character,
     const std::string &message,
     int start,
@@ -0,0 +1,103 @@
+#include "folder.hpp"
+#include "./std/compare.hpp"
+#include <charconv>
+#include <cmath>
+
+static bool is_number(const ast &program, node_index node) {
+    return program.kind(node) == tokenKind::NumberLiteral;
+}
+
+static double number_of(const ast &program, node_index node) {
+    return program.get<literal_node>(node).number;
+}
+
+// the text of a folded number is only read by error messages, the shortest
+// text that parses back into the same double
+static void replace_with_number(ast &program, node_index node, double number) {
+    char digits[32];
+    auto result = std::to_chars(digits, digits + sizeof(digits), number);
+    std::string_view text(digits, result.ptr - digits);
+
+    program.replace(node,
+        tokenKind::NumberLiteral,
+        literal_node{.value = program.intern(text), .number = number});
+}
+
+static void replace_with_boolean(ast &program, node_index node, bool value) {
+    program.replace(node,
+        tokenKind::BooleanLiteral,
+        literal_node{.value = program.intern(value ? "true" : "false")});
+}
+
+static void fold_binary(ast &program, node_index node) {
+    binary_node fields = program.get<binary_node>(node);
+    if (!is_number(program, fields.left) || !is_number(program, fields.right)) {
+        return;
+    }
+
+    double x = number_of(program, fields.left);
+    double y = number_of(program, fields.right);
+    const std::string &op = program.text(fields.op);
+
+    if (op == "+")
+        replace_with_number(program, node, x + y);
+    else if (op == "-")
+        replace_with_number(program, node, x - y);
+    else if (op == "*")
+        replace_with_number(program, node, x * y);
+    else if (op == "/")
+        replace_with_number(program, node, x / y);
+    else if (op == "^")
+        replace_with_number(program, node, std::pow(x, y));
+    else if (op == "%")
+        replace_with_number(program, node, std::fmod(x, y));
+}
+
+static void fold_comparison(ast &program, node_index node) {
+    binary_node fields = program.get<binary_node>(node);
+    if (!is_number(program, fields.left) || !is_number(program, fields.right)) {
+        return;
+    }
+
+    replace_with_boolean(program,
+        node,
+        compare_number(number_of(program, fields.left),
+            number_of(program, fields.right),
+            program.text(fields.op)));
+}
+
+static void fold_unary(ast &program, node_index node) {
+    unary_node fields = program.get<unary_node>(node);
+    const std::string &op = program.text(fields.op);
+    tokenKind kind = program.kind(fields.right);
+
+    if (op == "-" && kind == tokenKind::NumberLiteral) {
+        replace_with_number(program, node, -number_of(program, fields.right));
+    } else if (op == "!" && kind == tokenKind::NumberLiteral) {
+        // every number is truthy
+        replace_with_boolean(program, node, false);
+    } else if (op == "!" && kind == tokenKind::BooleanLiteral) {
+        replace_with_boolean(
+            program, node, program.value(fields.right) == "false");
+    }
+}
+
+void fold_constants(ast &program) {
+    // operands come before the expressions that use them, so nested constant
+    // expressions fold from the inside out in one pass
+    for (node_index node = 0; node < program.size(); node++) {
+        switch (program.kind(node)) {
+        case tokenKind::BinaryExpr:
+            fold_binary(program, node);
+            break;
+        case tokenKind::ComparisonExpr:
+            fold_comparison(program, node);
+            break;
+        case tokenKind::UnaryExpr:
+            fold_unary(program, node);
+            break;
+        default:
+            break;
+        }
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "ast.hpp"
+
+// replaces binary, comparison and unary expressions whose operands are
+// literals with the literal they evaluate to, so loops do not redo them on
+// every iteration. runs on the ast before the resolver and the bytecode
+// compiler see it.
+//
+// only expressions that give the same result in the tree-walker and the vm
+// are folded: arithmetic and comparisons of two numbers, negating a number and
+// ! on a number or boolean. everything that could fail at runtime, like
+// adding a number to a string, is left for the interpreter to report.
+void fold_constants(ast &program);
@@ -1,618 +1,879 @@
-#define an_ptr std::unique_ptr<abstract_node>
-
 #include "./magic_enum/magic_enum.hpp"
 #include "./std/compare.hpp"
 #include "debugger.hpp"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <memory>
 
-void scope_erase(scope *env, scope *scope_env) {
-    auto it = std::find(env->closures.begin(), env->closures.end(), scope_env);
-    if (it != env->closures.end()) {
-        env->closures.erase(it);
+// the ast of the program, set by interpret_program. function prototypes keep
+// the node lists of their bodies so it has to outlive them
+static ast *tree = nullptr;
+
+constexpr size_t interpreter_stack_size = 1 << 18;
+// calls recurse on the c++ stack, this keeps them well inside the default 8mb
+constexpr int interpreter_max_depth = 1 << 13;
+
+// the locals of a running function or of the top level code live in a fixed
+// window of value_stack starting at base, params first. loops keep theirs in
+// the window they run in. a call puts the callee right below base so it stays
+// rooted until it returns
+struct interpreter_frame {
+    // null for the top level code
+    function *closure;
+    gem_value *base;
+    interpreter_frame *caller;
+};
+
+static std::vector<gem_value> value_stack;
+// everything below it is marked as a root on every collection
+static gem_value *stack_top = nullptr;
+static interpreter_frame *frame = nullptr;
+static int call_depth = 0;
+// upvalues that still point into value_stack, sorted by slot
+static std::vector<std::shared_ptr<gem_upvalue>> open_upvalues;
+
+// takes slot_count unset slots off the top of value_stack
+static gem_value *push_window(size_t slot_count, scope *env, int line) {
+    if (stack_top + slot_count > value_stack.data() + value_stack.size()) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Stack overflow!");
+        exit(1);
     }
+
+    gem_value *window = stack_top;
+    std::fill_n(window, slot_count, gem_value::empty());
+    stack_top += slot_count;
+    return window;
+}
+
+static std::shared_ptr<gem_upvalue> capture_upvalue(gem_value *slot) {
+    size_t index = open_upvalues.size();
+    while (index > 0 && open_upvalues[index - 1]->location >= slot) {
+        if (open_upvalues[index - 1]->location == slot) {
+            return open_upvalues[index - 1];
+        }
+        index--;
+    }
+
+    auto upvalue = std::make_shared<gem_upvalue>(
+        gem_upvalue{.location = slot, .closed = gem_value::null()});
+    open_upvalues.insert(open_upvalues.begin() + index, upvalue);
+    return upvalue;
 }
 
-void trace_back_me_rec(std::string &trace, astToken &node) {
-    if (node.object->kind == tokenKind::MemberExpr) {
-        trace_back_me_rec(trace, *node.object);
+static void close_upvalues(gem_value *level) {
+    while (!open_upvalues.empty() && open_upvalues.back()->location >= level) {
+        gem_upvalue *upvalue = open_upvalues.back().get();
+        upvalue->closed = *upvalue->location;
+        // the cell can be shared with closures that are already old
+        remember_value(upvalue->closed);
+        upvalue->location = &upvalue->closed;
+        open_upvalues.pop_back();
+    }
+}
+
+void trace_back_me_rec(std::string &trace, member_node &node) {
+    if (tree->kind(node.object) == tokenKind::MemberExpr) {
+        trace_back_me_rec(trace, tree->get<member_node>(node.object));
     } else {
-        trace += node.object->value;
+        trace += tree->value(node.object);
     }
 
     if (node.computed) {
-        trace += "[" + node.property->value + "]";
+        trace += "[" + tree->value(node.property) + "]";
     } else {
-        trace += "." + node.property->value;
+        trace += "." + tree->value(node.property);
     }
 }
 
-std::string trace_back_member_expression(astToken &node) {
+std::string trace_back_member_expression(member_node &node) {
     std::string trace;
     trace_back_me_rec(trace, node);
     return trace;
 }
 
-bool is_truthy(gem_value *value) {
-    if (value->value_type == gem_type::gem_null) {
+bool is_truthy(gem_value value) {
+    if (value.is_null()) {
         return false;
-    } else if (value->value_type == gem_type::gem_bool) {
-        return value->boolean;
+    } else if (value.is_bool()) {
+        return value.as_bool();
     } else {
         return true;
     }
 }
 
-an_ptr interpret_program(astToken &node, scope *env) {
-    an_ptr result = nullptr;
+completion interpret_program(
+    ast &program, const function_prototype *main, scope *env) {
+    tree = &program;
+
+    if (value_stack.empty()) {
+        value_stack.assign(interpreter_stack_size, gem_value::empty());
+        stack_top = value_stack.data();
+    }
+
+    gem_value *base = push_window(main->slot_count, env, 0);
+    interpreter_frame top_level{
+        .closure = nullptr, .base = base, .caller = frame};
+    frame = &top_level;
 
-    for (auto &token : node.body) {
-        an_ptr return_result = interpret(*token, env);
+    completion result;
+    for (node_index token : program.items(main->body)) {
+        result = interpret(token, env);
 
-        if (dynamic_cast<return_literal *>(return_result.get())) {
-            result = std::move(return_result);
+        if (result.type == completion_type::returned) {
             break;
         }
     }
 
-    return result;
-}
+    close_upvalues(base);
+    frame = top_level.caller;
+    stack_top = base;
 
-an_ptr interpret_body(std::vector<std::shared_ptr<astToken>> body, scope *env) {
-    an_ptr result = nullptr;
+    return result.type == completion_type::returned ? result : completion{};
+}
 
-    for (auto &token : body) {
-        an_ptr return_result = interpret(*token, env);
+// runs statements until one of them returns, breaks or continues
+completion interpret_body(node_list body, scope *env) {
+    for (node_index token : tree->items(body)) {
+        completion result = interpret(token, env);
 
-        if (dynamic_cast<return_literal *>(return_result.get())) {
-            result = std::move(return_result);
-            break;
+        if (result.type != completion_type::normal) {
+            return result;
         }
+    }
 
-        if (dynamic_cast<break_literal *>(return_result.get())) {
-            result = std::move(return_result);
-            break;
-        }
+    return completion{};
+}
 
-        if (dynamic_cast<continue_literal *>(return_result.get())) {
-            result = std::move(return_result);
-            break;
-        }
+// the slot a resolved identifier, var or function declaration refers to
+gem_value *variable_slot(variable_kind binding, int slot) {
+    switch (binding) {
+    case variable_kind::global:
+        return root->global_slots[slot];
+    case variable_kind::local:
+        return &frame->base[slot];
+    default:
+        return frame->closure->upvalues[slot]->location;
     }
+}
 
-    return result;
+// frames are scanned on every collection, only the root scope and closed
+// upvalues need a barrier
+void store_variable(variable_kind binding, int slot, gem_value value) {
+    if (binding == variable_kind::global) {
+        root->write_barrier(value);
+    } else if (binding == variable_kind::upvalue) {
+        remember_value(value);
+    }
+    *variable_slot(binding, slot) = value;
 }
 
-an_ptr interpret_function_declaration(astToken &node, scope *env) {
-    gem_value *function_value = make_value(gem_type::gem_function, true, env);
+completion interpret_function_declaration(node_index index, scope *env) {
+    function_node &node = tree->get<function_node>(index);
+    const function_prototype *prototype = &gem_prototypes[node.prototype];
+    gem_object *function_object = make_object(gem_type::gem_function, env);
     function *func = new function;
     func->function_type = gem_function_type::default_function;
-    func->body = node.body;
+    func->prototype = prototype;
     func->declaration_enviroment = env;
-    func->params = node.params;
+    func->upvalues.reserve(prototype->upvalues.size());
 
-    function_value->func = func;
+    for (auto &upvalue : prototype->upvalues) {
+        func->upvalues.push_back(
+            upvalue.in_stack ? capture_upvalue(frame->base + upvalue.index)
+                             : frame->closure->upvalues[upvalue.index]);
+    }
 
-    an_ptr value = std::make_unique<abstract_node>();
+    function_object->func = func;
+    gem_value function_value = gem_value::object(function_object);
 
-    if (node.name == "") {
-        value->value = function_value;
-    } else {
-        value->value = env->make_variable(node.name, function_value);
+    if (node.name != empty_string) {
+        store_variable(node.binding, node.slot, function_value);
     }
 
-    return value;
+    return completion{function_value};
 }
 
-an_ptr interpret_call_expr(astToken &node, scope *env) {
-    an_ptr fn = interpret(*node.caller, env);
+// runs a tree-walker function in a new window on top of value_stack, the
+// arguments are evaluated straight into the slots of its params
+static gem_value call_function(
+    gem_value fn, node_list args, scope *env, int line) {
+    function *callee = fn.as_function();
+    const function_prototype *prototype = callee->prototype;
+    int param_count = prototype->param_count;
 
-    if (fn->value->value_type != gem_type::gem_function) {
+    if (call_depth >= interpreter_max_depth) {
         error(error_type::runtime_error,
             "",
             env->file_name,
-            node.line,
-            "Cannot call a non-function value(" +
-                std::string(magic_enum::enum_name(fn->value->value_type)) +
-                ")");
+            line,
+            "Stack overflow!");
         exit(1);
-    };
+    }
 
-    std::vector<gem_value *> args;
+    gem_value *window = push_window(prototype->slot_count + 1, env, line);
+    gem_value *base = window + 1;
+    window[0] = fn;
 
-    for (auto &value : node.args) {
-        args.push_back(interpret(*value, env)->value);
+    int index = 0;
+    for (node_index value : tree->items(args)) {
+        gem_value argument = interpret(value, env).value;
+        if (index < param_count) {
+            base[index] = argument;
+        }
+        index++;
     }
 
-    an_ptr return_result = std::make_unique<abstract_node>();
+    for (; index < param_count; ++index) {
+        base[index] = gem_value::null();
+    }
 
-    if (fn->value->func->function_type == gem_function_type::native_function) {
-        gem_value *result = fn->value->func->caller(args, env, node.line);
-        return_result->value =
-            result != nullptr ? result : env->get_variable("null");
-    } else if (fn->value->func->function_type ==
-               gem_function_type::metadata_function) {
-        args.insert(args.begin(), interpret(*node.caller->object, env)->value);
-        gem_value *result = fn->value->func->caller(args, env, node.line);
-        return_result->value =
-            result != nullptr ? result : env->get_variable("null");
-    } else {
-        scope *scope_env = new scope(false);
-        scope_env->file_name =
-            fn->value->func->declaration_enviroment->file_name;
-        scope_env->parent_env = fn->value->func->declaration_enviroment;
-        mark_scope(scope_env);
-        push_heap_closures(scope_env);
+    interpreter_frame callee_frame{
+        .closure = callee, .base = base, .caller = frame};
+    frame = &callee_frame;
+    call_depth++;
 
-        fn->value->func->declaration_enviroment->closures.push_back(scope_env);
+    // only the value leaves the call, a stray break or continue ends the
+    // function like a return without a value
+    gem_value result =
+        interpret_body(prototype->body, callee->declaration_enviroment).value;
 
-        int param_count = fn->value->func->params.size();
+    close_upvalues(base);
+    frame = callee_frame.caller;
+    stack_top = window;
+    call_depth--;
 
-        for (int index = 0; index < param_count; ++index) {
-            scope_env->make_variable(fn->value->func->params[index],
-                args.size() >= (index + 1) ? args[index]
-                                           : env->get_variable("null"));
-        }
+    return result;
+}
+
+completion interpret_member_of(node_index index, gem_value obj, scope *env);
 
-        an_ptr result = interpret_body(fn->value->func->body, scope_env);
-        return_result->value =
-            result != nullptr ? result->value : env->get_variable("null");
-        scope_erase(fn->value->func->declaration_enviroment, scope_env);
+completion interpret_call_expr(node_index index, scope *env) {
+    call_node &node = tree->get<call_node>(index);
+    int line = tree->line(index);
+    temp_roots roots;
+
+    // the receiver of a method is evaluated once, for the lookup and as self
+    gem_value self = gem_value::null();
+    gem_value fn;
+    if (tree->kind(node.caller) == tokenKind::MemberExpr) {
+        self = interpret(tree->get<member_node>(node.caller).object, env).value;
+        roots.push(self);
+        fn = interpret_member_of(node.caller, self, env).value;
+    } else {
+        fn = interpret(node.caller, env).value;
     }
 
-    return return_result;
-}
+    if (fn.type() != gem_type::gem_function) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Cannot call a non-function value(" +
+                std::string(magic_enum::enum_name(fn.type())) + ")");
+        exit(1);
+    };
 
-an_ptr interpret_while_loop(astToken &node, scope *env) {
-    scope *scope_env = new scope(false);
-    scope_env->file_name = env->file_name;
-    scope_env->parent_env = env;
-    mark_scope(scope_env);
-    push_heap_closures(scope_env);
+    function *callee = fn.as_function();
+    if (callee->function_type == gem_function_type::default_function) {
+        return completion{call_function(fn, node.args, env, line)};
+    }
 
-    env->closures.push_back(scope_env);
+    // natives get a window of callee, receiver and arguments
+    size_t count = node.args.size;
+    gem_value *window = push_window(count + 2, env, line);
+    window[0] = fn;
+    if (callee->function_type == gem_function_type::metadata_function) {
+        window[1] = self;
+    }
 
-    while (is_truthy(interpret(*node.left, scope_env)->value)) {
-        an_ptr return_result = interpret_body(node.body, scope_env);
+    size_t at = 2;
+    for (node_index value : tree->items(node.args)) {
+        window[at++] = interpret(value, env).value;
+    }
 
-        if (dynamic_cast<return_literal *>(return_result.get())) {
-            scope_erase(env, scope_env);
+    gem_value result = call_native(callee,
+        window[1],
+        std::span<const gem_value>(window + 2, count),
+        env,
+        line);
+    stack_top = window;
 
-            return std::move(return_result);
-        }
+    return completion{result};
+}
 
-        if (dynamic_cast<break_literal *>(return_result.get())) {
-            break;
-        }
+static void native_argument_error(
+    const std::string &message, scope *env, u_int64_t line) {
+    error(error_type::runtime_error, "", env->file_name, line, message);
+    exit(1);
+}
 
-        if (dynamic_cast<continue_literal *>(return_result.get())) {
-            continue;
+static void check_argument(gem_value value,
+    gem_type expected,
+    size_t position,
+    scope *env,
+    u_int64_t line) {
+    if (expected != gem_type::gem_any && value.type() != expected) {
+        native_argument_error("Invalid argument at position " +
+                                  std::to_string(position) + "! Expected " +
+                                  gem_type_tostring(expected) + ", got " +
+                                  gem_type_tostring(value.type()),
+            env,
+            line);
+    }
+}
+
+gem_value call_native(function *callee,
+    gem_value receiver,
+    std::span<const gem_value> args,
+    scope *env,
+    u_int64_t line) {
+    const native_signature &signature = *callee->signature;
+    gem_value self = gem_value::null();
+    // self counts as the first position in the messages
+    size_t first = signature.method ? 1 : 0;
+
+    if (signature.method) {
+        if (!receiver.is_empty() && args.size() <= signature.param_count) {
+            self = receiver;
+        } else if (!args.empty()) {
+            self = args[0];
+            args = args.subspan(1);
+        } else {
+            native_argument_error("Too few arguments! Expected " +
+                                      std::to_string(signature.param_count + 1) +
+                                      ", got 0",
+                env,
+                line);
         }
     }
 
-    auto value = std::make_unique<abstract_node>();
-    value->value = env->get_variable("null");
+    if (args.size() != signature.param_count &&
+        (args.size() < signature.param_count || !signature.variadic)) {
+        native_argument_error(
+            std::string(args.size() > signature.param_count ? "Too many"
+                                                            : "Too few") +
+                " arguments! Expected " +
+                std::to_string(signature.param_count + first) + ", got " +
+                std::to_string(args.size() + first),
+            env,
+            line);
+    }
 
-    scope_erase(env, scope_env);
+    if (signature.method) {
+        check_argument(self, signature.self, 0, env, line);
+    }
 
-    return value;
-}
+    for (size_t index = 0; index < signature.param_count; ++index) {
+        check_argument(
+            args[index], signature.params[index], index + first, env, line);
+    }
 
-an_ptr interpret_for_loop(astToken &node, scope *env) {
-    scope *scope_env = new scope(false);
-    scope_env->file_name = env->file_name;
-    scope_env->parent_env = env;
-    mark_scope(scope_env);
-    push_heap_closures(scope_env);
+    return callee->caller(self, args, env, line);
+}
 
-    env->closures.push_back(scope_env);
+completion interpret_if_statement(node_index index, scope *env) {
+    if_node &node = tree->get<if_node>(index);
 
-    auto iterator = node.iterator;
+    if (is_truthy(interpret(node.condition, env).value)) {
+        return interpret_body(node.body, env);
+    }
 
-    if (std::holds_alternative<std::shared_ptr<astToken>>(iterator)) {
-        // iterator function loop
-    } else {
-        // numerical loop
-        auto new_iterator =
-            std::get<std::vector<std::shared_ptr<astToken>>>(iterator);
+    for (node_index elif : tree->items(node.elifs)) {
+        if_node &branch = tree->get<if_node>(elif);
 
-        if (new_iterator.size() < 2) {
-            error(error_type::runtime_error,
-                "",
-                scope_env->file_name,
-                node.line,
-                "Missing iterator in for loop declaration!");
-            exit(1);
+        if (is_truthy(interpret(branch.condition, env).value)) {
+            return interpret_body(branch.body, env);
         }
+    }
 
-        auto start = new_iterator[0];
-        auto end = new_iterator[1];
-        auto step = new_iterator.size() > 2
-                        ? new_iterator[2]
-                        : std::make_shared<astToken>(astToken{
-                              .kind = tokenKind::NumberLiteral, .value = "1"});
+    return interpret_body(node.else_body, env);
+}
 
-        if (node.params.size() == 0) {
-            error(error_type::runtime_error,
-                "",
-                scope_env->file_name,
-                node.line,
-                "Missing variable in for loop declaration!");
-            exit(1);
-        }
-        std::stringstream sds;
+// loops start with their slots unset, so a local read before its
+// declaration still falls back to the global
+static void clear_slots(int first_slot, int slot_count) {
+    std::fill_n(frame->base + first_slot, slot_count, gem_value::empty());
+}
 
-        gem_value *start_value = scope_env->make_variable(
-            node.params[0], interpret(*start, scope_env)->value);
+completion interpret_while_loop(node_index index, scope *env) {
+    while_node &node = tree->get<while_node>(index);
+    clear_slots(node.first_slot, node.slot_count);
 
-        sds << start_value;
-        scope_env->make_variable(sds.str(), start_value);
-        sds.str("");
-        sds.clear();
-        
-        gem_value *end_value = interpret(*end, scope_env)->value;
+    completion result;
+    while (is_truthy(interpret(node.condition, env).value)) {
+        completion step = interpret_body(node.body, env);
 
-        sds << end_value;
-        scope_env->make_variable(sds.str(), end_value);
-        sds.str("");
-        sds.clear();
+        if (step.type == completion_type::returned) {
+            result = step;
+            break;
+        }
 
-        gem_value *step_value = interpret(*step, scope_env)->value;
+        if (step.type == completion_type::broke) {
+            break;
+        }
+    }
 
-        sds << step_value;
-        scope_env->make_variable(sds.str(), step_value);
-        sds.str("");
-        sds.clear();
+    close_upvalues(frame->base + node.first_slot);
 
-        if (start_value->value_type != gem_type::gem_number) {
-            error(error_type::runtime_error,
-                add_pointers("^", "(x, ?, ?)", 1, 1),
-                scope_env->file_name,
-                node.line,
-                "Expected gem_number, got " + std::string(magic_enum::enum_name(
-                                                  start_value->value_type)));
-            exit(1);
-        }
+    return result;
+}
 
-        if (end_value->value_type != gem_type::gem_number) {
-            error(error_type::runtime_error,
-                add_pointers("^", "(?, x, ?)", 4, 4),
-                scope_env->file_name,
-                node.line,
-                "Expected gem_number, got " +
-                    std::string(magic_enum::enum_name(end_value->value_type)));
-            exit(1);
-        }
+completion interpret_for_loop(node_index node_at, scope *env) {
+    for_node &node = tree->get<for_node>(node_at);
+    int line = tree->line(node_at);
+    clear_slots(node.first_slot, node.slot_count);
 
-        if (step_value->value_type != gem_type::gem_number) {
-            error(error_type::runtime_error,
-                add_pointers("^", "(?, ?, x)", 7, 7),
-                scope_env->file_name,
-                node.line,
-                "Expected gem_number, got " +
-                    std::string(magic_enum::enum_name(step_value->value_type)));
-            exit(1);
-        }
+    completion result;
+    auto range = tree->items(node.range);
 
-        while (start_value->number < end_value->number) {
-            an_ptr return_result = interpret_body(node.body, scope_env);
+    if (range.size() < 2) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Missing iterator in for loop declaration!");
+        exit(1);
+    }
 
-            if (dynamic_cast<return_literal *>(return_result.get())) {
-                scope_erase(env, scope_env);
+    if (node.params.size == 0) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Missing variable in for loop declaration!");
+        exit(1);
+    }
+    gem_value start_value = interpret(range[0], env).value;
+    frame->base[node.slot] = start_value;
+    gem_value end_value = interpret(range[1], env).value;
+    gem_value step_value = range.size() > 2
+                               ? interpret(range[2], env).value
+                               : gem_value::number(1);
+
+    if (start_value.type() != gem_type::gem_number) {
+        error(error_type::runtime_error,
+            add_pointers("^", "(x, ?, ?)", 1, 1),
+            env->file_name,
+            line,
+            "Expected gem_number, got " +
+                std::string(magic_enum::enum_name(start_value.type())));
+        exit(1);
+    }
 
-                return std::move(return_result);
-            }
+    if (end_value.type() != gem_type::gem_number) {
+        error(error_type::runtime_error,
+            add_pointers("^", "(?, x, ?)", 4, 4),
+            env->file_name,
+            line,
+            "Expected gem_number, got " +
+                std::string(magic_enum::enum_name(end_value.type())));
+        exit(1);
+    }
 
-            if (dynamic_cast<break_literal *>(return_result.get())) {
-                break;
-            }
+    if (step_value.type() != gem_type::gem_number) {
+        error(error_type::runtime_error,
+            add_pointers("^", "(?, ?, x)", 7, 7),
+            env->file_name,
+            line,
+            "Expected gem_number, got " +
+                std::string(magic_enum::enum_name(step_value.type())));
+        exit(1);
+    }
+
+    // the counter lives here, the loop variable only gets a copy of it
+    double index = start_value.as_number();
+    double end_number = end_value.as_number();
+    double step_number = step_value.as_number();
 
-            if (dynamic_cast<continue_literal *>(return_result.get())) {
-                start_value->number += step_value->number;
-                continue;
-            };
+    while (index < end_number) {
+        frame->base[node.slot] = gem_value::number(index);
+        completion step = interpret_body(node.body, env);
+
+        if (step.type == completion_type::returned) {
+            result = step;
+            break;
+        }
 
-            start_value->number += step_value->number;
+        if (step.type == completion_type::broke) {
+            break;
         }
+
+        index += step_number;
     }
 
-    auto value = std::make_unique<abstract_node>();
-    value->value = env->get_variable("null");
-    scope_erase(env, scope_env);
+    close_upvalues(frame->base + node.first_slot);
 
-    return value;
+    return result;
 }
 
-an_ptr interpret_keyword(astToken &node, scope *env) {
-    if (node.value == "break") {
-        auto break_value = std::make_unique<break_literal>();
-        return break_value;
-    } else if (node.value == "continue") {
-        auto continue_value = std::make_unique<continue_literal>();
-        return continue_value;
+completion interpret_keyword(node_index index, scope *env) {
+    const std::string &value = tree->value(index);
+
+    if (value == "break") {
+        return completion{gem_value::null(), completion_type::broke};
+    } else if (value == "continue") {
+        return completion{gem_value::null(), completion_type::continued};
     } else {
         error(error_type::runtime_error,
-            add_pointers("~", node.value, 0, node.value.size()),
+            add_pointers("~", value, 0, value.size()),
             env->file_name,
-            node.line,
+            tree->line(index),
             "Invalid keyword!");
         exit(1);
     }
 }
 
-an_ptr interpret_identifier(astToken &node, scope *env) {
-    an_ptr value = std::make_unique<abstract_node>();
-    value->value = env->get_variable(node.value);
-    return value;
-}
+completion interpret_identifier(node_index index, scope *env) {
+    identifier_node &node = tree->get<identifier_node>(index);
+    gem_value value = *variable_slot(node.binding, node.slot);
 
-an_ptr interpret_assignment(astToken &node, scope *env) {
-    if (node.left->kind == tokenKind::MemberExpr) {
-        an_ptr left = interpret(*node.left, env);
-        an_ptr right = interpret(*node.right, env);
-
-        left->value = right->value;
+    // a hoisted local read before its declaration still sees the global
+    if (value.is_empty()) {
+        value = root->get_variable(tree->text(node.name));
+    }
+    return completion{value};
+}
 
-        an_ptr value = std::make_unique<abstract_node>();
-        value->value = left->value;
+completion interpret_member_assignment(node_index index, scope *env);
 
-        return value;
+completion interpret_assignment(node_index index, scope *env) {
+    binary_node &node = tree->get<binary_node>(index);
 
+    if (tree->kind(node.left) == tokenKind::MemberExpr) {
+        return interpret_member_assignment(index, env);
     } else {
-        auto left = node.left->value;
-        an_ptr right = interpret(*node.right, env);
-        gem_value *assigned = env->set_variable(left, right->value);
-
-        if (assigned == nullptr) {
+        identifier_node &target = tree->get<identifier_node>(node.left);
+        auto &left = tree->text(target.name);
+        gem_value right = interpret(node.right, env).value;
+        gem_value *slot = variable_slot(target.binding, target.slot);
+
+        if (!slot->is_empty()) {
+            store_variable(target.binding, target.slot, right);
+        } else if (target.binding == variable_kind::global ||
+                   !root->set_variable(left, right)) {
             std::string message =
-                left + " " + node.op + " " +
-                std::string(magic_enum::enum_name(right->value->value_type));
+                left + " " + tree->text(node.op) + " " +
+                std::string(magic_enum::enum_name(right.type()));
 
             error(error_type::runtime_error,
                 add_pointers("~", message, 0, message.size()),
                 env->file_name,
-                node.line,
+                tree->line(index),
                 "Non-existent variable!");
             exit(1);
         }
 
-        an_ptr value = std::make_unique<abstract_node>();
-        value->value = assigned;
-
-        return value;
+        return completion{right};
     }
 }
 
-an_ptr interpret_var_declaration(astToken &node, scope *env) {
-    an_ptr value = std::make_unique<abstract_node>();
-    value->value =
-        env->make_variable(node.name, interpret(*node.right, env)->value);
-    return value;
+completion interpret_var_declaration(node_index index, scope *env) {
+    variable_node &node = tree->get<variable_node>(index);
+    gem_value value = interpret(node.value, env).value;
+    store_variable(node.binding, node.slot, value);
+    return completion{value};
 }
 
-an_ptr interpret_return(astToken &node, scope *env) {
-    std::unique_ptr<return_literal> return_token =
-        std::make_unique<return_literal>();
-    return_token->value = interpret(*node.right, env)->value;
-    mark_value(return_token->value);
+completion interpret_return(node_index index, scope *env) {
+    node_index right = tree->get<unary_node>(index).right;
+    gem_value value =
+        right != no_node ? interpret(right, env).value : gem_value::null();
+    return completion{value, completion_type::returned};
+}
 
-    return return_token;
+completion interpret_numeric_literal(node_index index, scope *env) {
+    return completion{gem_value::number(tree->get<literal_node>(index).number)};
 }
 
-std::unique_ptr<number_literal> interpret_numeric_literal(
-    astToken &node, scope *env) {
-    std::unique_ptr<number_literal> value = std::make_unique<number_literal>();
-    value->value = make_value(gem_type::gem_number, true, env);
-    value->value->number = std::stod(node.value);
-    return value;
+// literals and property names are interned by the resolver, nodes it did
+// not see are interned on every evaluation
+static gem_value constant_string(int slot, const std::string &value) {
+    if (slot >= 0) {
+        return gem_constants[slot];
+    }
+    return make_string(value);
 }
 
-std::unique_ptr<string_literal> interpret_string_literal(
-    astToken &node, scope *env) {
-    std::unique_ptr<string_literal> value = std::make_unique<string_literal>();
-    value->value = make_value(gem_type::gem_string, true, env);
-    value->value->string = node.value;
-    value->value->metadata = root->get_variable("string")->table;
+completion interpret_string_literal(node_index index, scope *env) {
+    literal_node &node = tree->get<literal_node>(index);
+    gem_value value = constant_string(node.slot, tree->text(node.value));
 
-    return value;
+    gem_value string_metadata = root->get_variable("string");
+    if (string_metadata.type() == gem_type::gem_table) {
+        value.as_object()->metadata = string_metadata.as_table();
+    }
+
+    return completion{value};
 }
 
-std::unique_ptr<boolean_literal> interpret_boolean_literal(
-    astToken &node, scope *env) {
-    std::unique_ptr<boolean_literal> value =
-        std::make_unique<boolean_literal>();
-    value->value = make_value(gem_type::gem_bool, true, env);
-    value->value->boolean = (node.value == "false" ? false : true);
-    return value;
+completion interpret_boolean_literal(node_index index, scope *env) {
+    return completion{
+        gem_value::boolean(tree->value(index) == "false" ? false : true)};
 }
 
-gem_value *number_operation(
-    an_ptr &left, an_ptr &right, std::string op, scope *env) {
-    gem_value *value = make_value(gem_type::gem_number, true, env);
+gem_value number_operation(
+    gem_value left, gem_value right, const std::string &op, scope *env) {
+    double x = left.as_number();
+    double y = right.as_number();
+    double number = 0;
 
     if (op == "+")
-        value->number = (left->value->number) + (right->value->number);
+        number = x + y;
     else if (op == "-")
-        value->number = (left->value->number) - (right->value->number);
-    else if (op == "*")
-        value->number = (left->value->number) * (right->value->number);
+        number = x - y;
     else if (op == "*")
-        value->number = (left->value->number) / (right->value->number);
+        number = x * y;
+    else if (op == "/")
+        number = x / y;
     else if (op == "^")
-        value->number = std::pow((left->value->number), (right->value->number));
+        number = std::pow(x, y);
     else if (op == "%")
-        value->number =
-            std::fmod((left->value->number), (right->value->number));
-    return value;
+        number = std::fmod(x, y);
+    return gem_value::number(number);
 }
 
-an_ptr interpret_binary_operation(astToken &node, scope *env) {
-    an_ptr left = interpret(*node.left, env);
-    an_ptr right = interpret(*node.right, env);
-
-    if (left->value->value_type == gem_type::gem_number &&
-        right->value->value_type == gem_type::gem_number) {
-        std::unique_ptr<number_literal> value =
-            std::make_unique<number_literal>();
-        value->value = number_operation(left, right, node.op, env);
-        return value;
-    } else if (left->value->value_type == gem_type::gem_string &&
-               right->value->value_type == gem_type::gem_string &&
-               node.op == "+") {
-        std::unique_ptr<string_literal> value =
-            std::make_unique<string_literal>();
-        value->value = make_value(gem_type::gem_string, true, env);
-        new (&value->value->string) std::string();
-
-        value->value->string = (left->value->string) + (right->value->string);
-        return value;
+completion interpret_binary_operation(node_index index, scope *env) {
+    binary_node &node = tree->get<binary_node>(index);
+    const std::string &op = tree->text(node.op);
+    gem_value left = interpret(node.left, env).value;
+    temp_roots roots;
+    roots.push(left);
+    gem_value right = interpret(node.right, env).value;
+
+    gem_type left_type = left.type();
+    gem_type right_type = right.type();
+
+    if (left_type == gem_type::gem_number &&
+        right_type == gem_type::gem_number) {
+        return completion{number_operation(left, right, op, env)};
+    } else if (left_type == gem_type::gem_string &&
+               right_type == gem_type::gem_string && op == "+") {
+        return completion{make_string(left.as_string() + right.as_string())};
     } else {
         error(error_type::runtime_error,
             dynamic_format("Attempted to use the '{}' operator on {} and {}!",
-                node.op,
-                gem_type_tostring(left->value->value_type),
-                gem_type_tostring(right->value->value_type)),
+                op,
+                gem_type_tostring(left_type),
+                gem_type_tostring(right_type)),
             env->file_name,
-            node.line);
+            tree->line(index));
         exit(1);
     }
 }
 
-std::unique_ptr<boolean_literal> interpret_comparasion(
-    astToken &node, scope *env) {
-    an_ptr left = interpret(*node.left, env);
-    an_ptr right = interpret(*node.right, env);
+completion interpret_comparasion(node_index index, scope *env) {
+    binary_node &node = tree->get<binary_node>(index);
+    const std::string &op = tree->text(node.op);
+    gem_value left = interpret(node.left, env).value;
+    temp_roots roots;
+    roots.push(left);
+    gem_value right = interpret(node.right, env).value;
 
-    auto boolean_value = std::make_unique<boolean_literal>();
-    gem_type left_type = left->value->value_type;
-    gem_type right_type = right->value->value_type;
+    completion boolean_value;
+    gem_type left_type = left.type();
+    gem_type right_type = right.type();
 
     if (left_type == right_type) {
         if (left_type == gem_type::gem_number) {
-            boolean_value->value =
-                compare_number(
-                    left->value->number, right->value->number, node.op)
-                    ? env->get_variable("true")
-                    : env->get_variable("false");
+            boolean_value.value =
+                gem_value::boolean(compare_number(left.as_number(),
+                    right.as_number(),
+                    op));
         } else if (left_type == gem_type::gem_string) {
-            boolean_value->value =
-                compare_string(
-                    left->value->string, right->value->string, node.op)
-                    ? env->get_variable("true")
-                    : env->get_variable("false");
+            boolean_value.value =
+                gem_value::boolean(compare_string(left.as_string(),
+                    right.as_string(),
+                    op));
         } else if (left_type == gem_type::gem_bool) {
-            boolean_value->value =
-                compare_bool(
-                    left->value->boolean, right->value->boolean, node.op)
-                    ? env->get_variable("true")
-                    : env->get_variable("false");
+            boolean_value.value =
+                gem_value::boolean(compare_bool(
+                    left.as_bool(), right.as_bool(), op));
         } else if (left_type == gem_type::gem_table) {
-            boolean_value->value =
-                compare_table(left->value->table, right->value->table, node.op)
-                    ? env->get_variable("true")
-                    : env->get_variable("false");
+            boolean_value.value =
+                gem_value::boolean(compare_table(
+                    left.as_table(), right.as_table(), op));
         } else if (left_type == gem_type::gem_function) {
-            boolean_value->value =
-                compare_function(left->value->func, right->value->func, node.op)
-                    ? env->get_variable("true")
-                    : env->get_variable("false");
+            boolean_value.value =
+                gem_value::boolean(compare_function(left.as_function(),
+                    right.as_function(),
+                    op));
+        } else if (left_type == gem_type::gem_null) {
+            // null is only equal to itself, like in the vm
+            boolean_value.value = gem_value::boolean(op == "==");
         } else {
             std::string message =
-                std::string(magic_enum::enum_name(left_type)) + " " + node.op +
+                std::string(magic_enum::enum_name(left_type)) + " " + op +
                 " " + std::string(magic_enum::enum_name(right_type));
             std::string pointer_message =
                 add_pointers("~", message, 0, message.size());
             error(error_type::runtime_error,
                 pointer_message,
                 env->file_name,
-                node.line,
+                tree->line(index),
                 "Invalid value comparassion!");
             exit(1);
         }
     } else {
-        boolean_value->value = env->get_variable("false");
+        boolean_value.value = gem_value::boolean(false);
     }
 
     return boolean_value;
 }
 
-std::unique_ptr<boolean_literal> interpret_logic_gate(
-    astToken &node, scope *env) {
-    an_ptr left = interpret(*node.left, env);
-    an_ptr right = interpret(*node.right, env);
-    auto boolean_value = std::make_unique<boolean_literal>();
+completion interpret_logic_gate(node_index index, scope *env) {
+    binary_node &node = tree->get<binary_node>(index);
+    const std::string &op = tree->text(node.op);
+    gem_value left = interpret(node.left, env).value;
 
-    if (node.op == "and") {
-        if (left->value->value_type == gem_type::gem_null ||
-            left->value->boolean == false) {
-            boolean_value->value = left->value;
-            return boolean_value;
-        } else {
-            boolean_value->value = right->value;
-            return boolean_value;
-        }
-    } else if (node.op == "or") {
-        if (left->value->value_type == gem_type::gem_null ||
-            left->value->boolean == false) {
-            boolean_value->value = right->value;
-            return boolean_value;
-        } else {
-            boolean_value->value = left->value;
-            return boolean_value;
-        }
+    // the right side is only evaluated when it decides the result
+    if (op == "and" ? !is_truthy(left) : is_truthy(left)) {
+        return completion{left};
+    } else if (op == "and" || op == "or") {
+        return completion{interpret(node.right, env).value};
     } else {
         exit(1);
     }
 }
 
-std::unique_ptr<number_literal> interpret_unary(astToken &node, scope *env) {
-    auto value = std::make_unique<number_literal>();
-    auto original_value = interpret(*node.right, env)->value;
+completion interpret_unary(node_index index, scope *env) {
+    unary_node &node = tree->get<unary_node>(index);
+    const std::string &op = tree->text(node.op);
+    completion value;
+    gem_value original_value = interpret(node.right, env).value;
 
-    if (node.op == "-") {
-        if (original_value->value_type != gem_type::gem_number) {
+    if (op == "-") {
+        if (original_value.type() != gem_type::gem_number) {
             error(error_type::runtime_error,
-                add_pointers("^", node.op + "x", 1, 1),
+                add_pointers("^", op + "x", 1, 1),
                 env->file_name,
-                node.line,
+                tree->line(index),
                 "Invalid unary expression! Expected number, got " +
-                    std::string(
-                        magic_enum::enum_name(original_value->value_type)) +
+                    std::string(magic_enum::enum_name(original_value.type())) +
                     "!");
 
             exit(1);
         }
-        original_value->number *= -1;
-        value->value = original_value;
-    } else if (node.op == "!") {
-        gem_value *truthy = is_truthy(original_value) == true
-                                ? env->get_variable("false")
-                                : env->get_variable("true");
-        value->value = truthy;
+        value.value = gem_value::number(-original_value.as_number());
+    } else if (op == "!") {
+        value.value = gem_value::boolean(!is_truthy(original_value));
     } else {
         error(error_type::runtime_error,
-            add_pointers("^", node.op + "x", 0, 0),
+            add_pointers("^", op + "x", 0, 0),
             env->file_name,
-            node.line,
+            tree->line(index),
             "Invalid unary expression!");
         exit(1);
     }
 
     return value;
 }
+gem_table *metadata_of(gem_value value) {
+    return value.is_object() ? value.as_object()->metadata : nullptr;
+}
+
+// the shape tree keeps the string keys of its transitions alive, so a
+// transition can never be taken for a different string at the same address
+constexpr size_t max_shape_keys = 32;
+constexpr size_t max_shapes = 1 << 16;
+static std::vector<std::unique_ptr<gem_shape>> gem_shapes;
+static std::vector<gem_value> gem_shape_keys;
+
+gem_shape *shape_transition(gem_shape *shape, gem_value key) {
+    auto found = shape->transitions.find(key.raw());
+    if (found != shape->transitions.end()) {
+        return found->second;
+    }
 
-an_ptr interpret_member_expression(astToken &node, scope *env) {
-    an_ptr value = std::make_unique<abstract_node>();
+    // tables and functions as keys would be kept alive forever
+    if ((key.is_object() && key.type() != gem_type::gem_string) ||
+        shape->key_count >= max_shape_keys || gem_shapes.size() >= max_shapes) {
+        return nullptr;
+    }
+
+    gem_shapes.push_back(std::make_unique<gem_shape>());
+    gem_shape *next = gem_shapes.back().get();
+    next->key_count = shape->key_count + 1;
+    shape->transitions[key.raw()] = next;
+
+    if (key.is_object()) {
+        gem_shape_keys.push_back(key);
+    }
+
+    return next;
+}
+
+void member_cache_fill(member_cache &cache, gem_object *object, gem_value key) {
+    gem_table *table = object->table;
+    cache.shape = nullptr;
+
+    if (table->shape == nullptr) {
+        return;
+    }
+
+    int index = table->node_index(key);
+    if (index >= 0) {
+        cache.shape = table->shape;
+        cache.metadata = nullptr;
+        cache.index = index;
+        return;
+    }
+
+    gem_table *metadata = object->metadata;
+    if (metadata == nullptr || metadata->shape == nullptr) {
+        return;
+    }
+
+    index = metadata->node_index(key);
+    if (index >= 0) {
+        cache.shape = table->shape;
+        cache.metadata = metadata;
+        cache.metadata_shape = metadata->shape;
+        cache.index = index;
+    }
+}
+
+// nan is not equal to itself, so it could never be found again
+static void reject_nan_key(gem_value key, scope *env, int line) {
+    if (key.is_number() && std::isnan(key.as_number())) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Attempted to index a table with NaN!");
+        exit(1);
+    }
+}
+
+completion interpret_member_expression(node_index index, scope *env) {
+    member_node &node = tree->get<member_node>(index);
+    return interpret_member_of(index, interpret(node.object, env).value, env);
+}
+
+// looks the member of the site up on an object that was already evaluated
+completion interpret_member_of(node_index index, gem_value obj, scope *env) {
+    member_node &node = tree->get<member_node>(index);
+    int line = tree->line(index);
+    completion value;
+    temp_roots roots;
+    roots.push(obj);
 
     if (node.computed == true) {
-        an_ptr obj = interpret(*node.object, env);
-        an_ptr ident = interpret(*node.property, env);
+        gem_value ident = interpret(node.property, env).value;
+
+        if (ident.is_number()) {
+            reject_nan_key(ident, env, line);
+
+            gem_value *element = obj.type() == gem_type::gem_table
+                                     ? obj.as_table()->at(ident)
+                                     : nullptr;
 
-        if (ident->value->value_type == gem_type::gem_number) {
-            if (!obj->value || obj->value->table->array.size() == 0 ||
-                (obj->value->table->array.size() - 1) < ident->value->number) {
-                std::string last = "[" + node.property->value + "]";
+            if (element == nullptr) {
+                std::string last = "[" + tree->value(node.property) + "]";
                 std::string nmb = trace_back_member_expression(node);
                 error(error_type::runtime_error,
                     add_pointers("~",
@@ -620,110 +881,153 @@ an_ptr interpret_member_expression(astToken &node, scope *env) {
                         (nmb.size() - last.size()) + 1,
                         nmb.size() - 2),
                     env->file_name,
-                    node.line,
+                    line,
                     "Out of bounds!");
                 exit(1);
             }
-            value->value = obj->value->table->array[ident->value->number];
+            value.value = *element;
         } else {
             gem_value *at_position_value =
-                obj->value->table->hash_at(ident->value);
+                obj.type() == gem_type::gem_table
+                    ? obj.as_table()->hash_at(ident)
+                    : nullptr;
             if (at_position_value == nullptr) {
-                if (obj->value->metadata == nullptr) {
+                gem_table *metadata = metadata_of(obj);
+                if (metadata == nullptr) {
                     error(error_type::runtime_error,
                         "",
                         env->file_name,
-                        node.line,
+                        line,
                         "Attempted to index metadata of a non-metadata value!");
                     exit(1);
                 }
-                gem_value *meta = obj->value->metadata->hash_at(ident->value);
+                gem_value *meta = metadata->hash_at(ident);
 
-                value->value =
-                    meta == nullptr ? env->get_variable("null") : meta;
+                value.value = meta == nullptr ? gem_value::null() : *meta;
             } else {
-                value->value = at_position_value;
+                value.value = *at_position_value;
             }
         }
     } else {
-        an_ptr obj = interpret(*node.object, env);
-        std::string ident = node.property->value;
-
-        if (obj->value->value_type != gem_type::gem_table) {
+        if (obj.type() != gem_type::gem_table) {
             error(error_type::runtime_error,
                 "",
                 env->file_name,
-                node.line,
-                "Expected table, got " +
-                    gem_type_tostring(obj->value->value_type));
+                line,
+                "Expected table, got " + gem_type_tostring(obj.type()));
             exit(1);
         }
 
-        auto key = make_value(gem_type::gem_string, true, env);
-        key->string = ident;
+        // a hit in the inline cache of the site skips both hash lookups
+        gem_object *object = obj.as_object();
+        member_cache *cache =
+            node.slot >= 0 ? &gem_member_caches[node.slot] : nullptr;
+        if (cache && member_cache_hit(*cache, object, value.value)) {
+            return value;
+        }
+
+        gem_value key =
+            constant_string(node.key, tree->value(node.property));
 
-        gem_value *returned = obj->value->table->hash_at(key);
+        gem_value *returned = obj.as_table()->hash_at(key);
 
         if (returned == nullptr) {
-            if (obj->value->metadata == nullptr) {
+            gem_table *metadata = metadata_of(obj);
+            if (metadata == nullptr) {
                 error(error_type::runtime_error,
                     "",
                     env->file_name,
-                    node.line,
+                    line,
                     "Attempted to index metadata of a non-metadata value!");
                 exit(1);
             }
-            gem_value *meta = obj->value->metadata->hash_at(key);
+            gem_value *meta = metadata->hash_at(key);
 
-            value->value = meta == nullptr ? env->get_variable("null") : meta;
+            value.value = meta == nullptr ? gem_value::null() : *meta;
         } else {
-            value->value = returned;
+            value.value = *returned;
+        }
+
+        if (cache) {
+            member_cache_fill(*cache, object, key);
         }
     }
 
     return value;
 }
 
-an_ptr interpret_table_expression(astToken &node, scope *env) {
-    an_ptr value = std::make_unique<abstract_node>();
-    gem_table *table = new gem_table;
+// the object and the key are evaluated before the value, as in the vm
+completion interpret_member_assignment(node_index index, scope *env) {
+    binary_node &node = tree->get<binary_node>(index);
+    member_node &member = tree->get<member_node>(node.left);
+    int line = tree->line(index);
+    temp_roots roots;
+
+    gem_value object = interpret(member.object, env).value;
+    roots.push(object);
+    gem_value key =
+        member.computed
+            ? interpret(member.property, env).value
+            : constant_string(member.key, tree->value(member.property));
+    roots.push(key);
+    gem_value value = interpret(node.right, env).value;
+
+    if (object.type() != gem_type::gem_table) {
+        error(error_type::runtime_error,
+            "",
+            env->file_name,
+            line,
+            "Expected table, got " + gem_type_tostring(object.type()));
+        exit(1);
+    }
+    reject_nan_key(key, env, line);
 
-    gem_value *object = make_value(gem_type::gem_table, true, env);
-    object->table = table;
+    write_barrier(object.as_object(), key);
+    write_barrier(object.as_object(), value);
+    object.as_table()->set(key, value);
 
-    object->metadata = root->get_variable("table")->table;
+    return completion{value};
+}
 
-    for (auto &property : node.properties) {
-        gem_value *key = nullptr;
+completion interpret_table_expression(node_index index, scope *env) {
+    auto properties = tree->items(tree->get<object_node>(index).properties);
+    gem_table *table = new gem_table;
 
-        if (property.key->kind == tokenKind::Identifier) {
-            key = make_value(gem_type::gem_string, true, env);
+    gem_object *object = make_object(gem_type::gem_table, env);
+    object->table = table;
+    temp_roots roots;
+    roots.push(gem_value::object(object));
 
-            key->string = property.key->value;
-        } else {
-            key = interpret(*property.key, env)->value;
-        }
-        gem_value *value_at_key = interpret(*property.value, env)->value;
-        if (key->value_type == gem_type::gem_number) {
-            if (key->number >= table->array.size()) {
-                table->array.resize(key->number + 1, nullptr);
-            }
+    gem_value table_metadata = root->get_variable("table");
+    if (table_metadata.type() == gem_type::gem_table) {
+        object->metadata = table_metadata.as_table();
+    }
+
+    for (size_t at = 0; at < properties.size(); at += 2) {
+        node_index key_node = properties[at];
+        gem_value key;
 
-            table->array[key->number] = value_at_key;
+        if (tree->kind(key_node) == tokenKind::Identifier) {
+            identifier_node &identifier = tree->get<identifier_node>(key_node);
+            key = constant_string(identifier.slot, tree->text(identifier.name));
         } else {
-            table->hash_make(key, value_at_key);
+            key = interpret(key_node, env).value;
         }
+        roots.push(key);
+        gem_value value_at_key = interpret(properties[at + 1], env).value;
+
+        // the table can get promoted while its properties are evaluated
+        reject_nan_key(key, env, tree->line(index));
+        write_barrier(object, key);
+        write_barrier(object, value_at_key);
+        table->set(key, value_at_key);
     }
 
-    value->value = object;
-
-    return value;
+    return completion{gem_value::object(object)};
 }
 
-an_ptr interpret(astToken &node, scope *env) {
-    switch (node.kind) {
-    case tokenKind::Program:
-        return interpret_program(node, env);
+completion interpret(node_index node, scope *env) {
+    switch (tree->kind(node)) {
     case tokenKind::Identifier:
         return interpret_identifier(node, env);
     case tokenKind::NumberLiteral:
@@ -738,6 +1042,8 @@ an_ptr interpret(astToken &node, scope *env) {
         return interpret_binary_operation(node, env);
     case tokenKind::Keyword:
         return interpret_keyword(node, env);
+    case tokenKind::IfStmt:
+        return interpret_if_statement(node, env);
     case tokenKind::WhileLoopStmt:
         return interpret_while_loop(node, env);
     case tokenKind::ComparisonExpr:
@@ -762,9 +1068,9 @@ an_ptr interpret(astToken &node, scope *env) {
         return interpret_member_expression(node, env);
     default:
         error(error_type::runtime_error,
-            std::string(magic_enum::enum_name(node.kind)),
+            std::string(magic_enum::enum_name(tree->kind(node))),
             env->file_name,
-            node.line,
+            tree->line(node),
             "Invalid AST!");
         exit(1);
     }
@@ -772,109 +1078,401 @@ an_ptr interpret(astToken &node, scope *env) {
 
 // GC
 
-void mark_value(gem_value *value) {
-    if (!value || value->marked)
-        return;
-    value->marked = true;
+// old cells are skipped while the nursery is collected, the remembered sets
+// stand in for every old to young reference
+static bool collecting_young = false;
+
+// lazy sweep of the old generation after a full mark, every allocation
+// sweeps gc_sweep_step cells so the pause is spread over the mutator
+constexpr size_t gc_sweep_step = 64;
+static bool sweeping = false;
+static size_t sweep_objects_read = 0;
+static size_t sweep_objects_write = 0;
+static size_t sweep_closures_read = 0;
+static size_t sweep_closures_write = 0;
+static size_t sweep_live_bytes = 0;
+
+size_t object_bytes(gem_type object_type) {
+    switch (object_type) {
+    case gem_type::gem_table:
+        return sizeof(gem_object) + sizeof(gem_table);
+    case gem_type::gem_function:
+        return sizeof(gem_object) + sizeof(function);
+    default:
+        return sizeof(gem_object);
+    }
+}
+
+// estimates, they only have to be consistent for the pacer
+static size_t cell_bytes(gem_object *object) {
+    size_t bytes = object_bytes(object->value_type);
+
+    if (object->value_type == gem_type::gem_string) {
+        bytes += object->string.size();
+    } else if (object->value_type == gem_type::gem_table && object->table) {
+        gem_table *table = object->table;
+        bytes += table->array.capacity() * sizeof(gem_value) +
+                 table->nodes.capacity() * sizeof(gem_node);
+    } else if (object->value_type == gem_type::gem_function && object->func) {
+        bytes += object->func->upvalues.size() * sizeof(gem_upvalue);
+    }
+
+    return bytes;
+}
+
+static size_t cell_bytes(scope *env) {
+    return sizeof(scope) +
+           env->stack.size() * (sizeof(std::string) + sizeof(gem_value));
+}
+
+static void gc_log(const std::string &message) {
+    if (gc_settings.log) {
+        std::cerr << "[gc] " << message << std::endl;
+    }
+}
 
-    if (value->value_type == gem_type::gem_function && value->func) {
-        mark_scope(value->func->declaration_enviroment);
+static void trace_object(gem_object *object) {
+    if (object->value_type == gem_type::gem_function && object->func) {
+        mark_scope(object->func->declaration_enviroment);
+        for (auto &upvalue : object->func->upvalues) {
+            mark_value(*upvalue->location);
+        }
         return;
     }
 
-    if (value->value_type == gem_type::gem_table && value->table) {
-        auto t = value->table;
-        for (gem_value *v : t->array) {
-            mark_value(v);
+    if (object->value_type == gem_type::gem_table && object->table) {
+        auto t = object->table;
+        for (size_t index = 0; index < t->array.size(); index++) {
+            mark_value(t->array[index]);
         }
 
-        for (gem_entry *head : t->buckets) {
-            gem_entry *entry = head;
-            while (entry) {
-                mark_value(entry->value);
-                entry = entry->next;
+        for (gem_node &node : t->nodes) {
+            if (!node.key.is_empty()) {
+                mark_value(node.key);
+                mark_value(node.value);
             }
         }
     }
 
-    mark_scope(value->declaration_env);
+    mark_scope(object->declaration_env);
+}
+
+static void trace_scope(scope *env) {
+    for (auto &value : env->stack) {
+        mark_value(value.second);
+    }
+
+    mark_scope(env->parent_env);
+}
+
+void mark_object(gem_object *object) {
+    if (!object || object->marked)
+        return;
+    if (collecting_young && object->old)
+        return;
+    object->marked = true;
+    trace_object(object);
 }
 
 void mark_scope(scope *env) {
     if (!env || env->marked)
         return;
+    if (collecting_young && env->old)
+        return;
     env->marked = true;
+    trace_scope(env);
+}
 
-    for (auto &value : env->stack) {
-        gem_value *second = value.second;
+static void mark_roots() {
+    mark_scope(root);
+
+    for (gem_value *slot = value_stack.data(); slot < stack_top; ++slot) {
+        mark_value(*slot);
+    }
+
+    for (gem_value value : gem_constants) {
+        mark_value(value);
+    }
+
+    for (gem_value value : gem_shape_keys) {
+        mark_value(value);
+    }
 
-        mark_value(second);
+    for (gem_value value : gem_temp_roots) {
+        mark_value(value);
     }
 
-    for (auto &value : env->closures) {
-        mark_scope(value);
+    for (auto hook : gc_roots) {
+        hook();
     }
 }
 
-void garbage_collect() {
-    mark_scope(root);
+// frees the unmarked part of the nursery and moves the rest to the old
+// generation. promoted cells stay marked while an old sweep is pending so
+// the sweeper does not take them for garbage
+template <typename T>
+static size_t promote_nursery(std::vector<T *> &nursery, std::vector<T *> &old) {
+    size_t promoted = 0;
+
+    for (T *cell : nursery) {
+        if (!cell->marked) {
+            delete cell;
+            gc_statistics.freed_cells++;
+            continue;
+        }
+
+        cell->marked = sweeping;
+        cell->old = true;
+        promoted += cell_bytes(cell);
+        old.push_back(cell);
+    }
 
-    int closure_deleted = 0;
-    int objects_deleted = 0;
+    nursery.clear();
+    return promoted;
+}
 
-    for (auto it = gem_heap_closures.begin(); it != gem_heap_closures.end();) {
-        scope *env = *it;
-        if (!env->marked) {
-            delete env;
-            closure_deleted++;
-            it = gem_heap_closures.erase(it);
-        } else {
-            env->marked = false;
-            ++it;
+static void forget_remembered() {
+    for (gem_object *object : gem_remembered_objects) {
+        object->remembered = false;
+    }
+
+    for (scope *env : gem_remembered_scopes) {
+        env->remembered = false;
+    }
+
+    gem_remembered_objects.clear();
+    gem_remembered_scopes.clear();
+    gem_remembered_values.clear();
+}
+
+// compacts [read, end) of the old generation in place, keeping marked cells
+template <typename T>
+static bool sweep_old(
+    std::vector<T *> &old, size_t &read, size_t &write, size_t budget) {
+    while (read < old.size() && budget > 0) {
+        T *cell = old[read++];
+        budget--;
+
+        if (!cell->marked) {
+            delete cell;
+            gc_statistics.freed_cells++;
+            continue;
         }
+
+        cell->marked = false;
+        sweep_live_bytes += cell_bytes(cell);
+        old[write++] = cell;
     }
 
-    for (auto it = gem_heap_objects.begin(); it != gem_heap_objects.end();) {
-        gem_value *value = *it;
+    if (read < old.size()) {
+        return false;
+    }
 
-        if (!value->marked) {
-            delete value;
-            objects_deleted++;
-            it = gem_heap_objects.erase(it);
-        } else {
-            value->marked = false;
-            ++it;
+    old.resize(write);
+    return true;
+}
+
+static void sweep_step(size_t budget) {
+    bool objects_done = sweep_old(
+        gem_heap_objects, sweep_objects_read, sweep_objects_write, budget);
+    bool closures_done = sweep_old(
+        gem_heap_closures, sweep_closures_read, sweep_closures_write, budget);
+
+    if (!objects_done || !closures_done) {
+        return;
+    }
+
+    // promotions during the sweep were counted by the sweeper as well
+    sweeping = false;
+    gc_statistics.live_bytes = sweep_live_bytes;
+    gc_statistics.old_bytes = sweep_live_bytes;
+    gc_statistics.full_threshold =
+        std::max(sweep_live_bytes * gc_settings.pause / 100,
+            gc_settings.nursery_bytes * 4);
+
+    gc_log("swept, " + std::to_string(gc_statistics.live_bytes) +
+           " bytes live, next full collection at " +
+           std::to_string(gc_statistics.full_threshold) + " bytes");
+}
+
+void collect_young() {
+    collecting_young = true;
+
+    mark_roots();
+
+    for (gem_object *object : gem_remembered_objects) {
+        trace_object(object);
+    }
+
+    for (scope *env : gem_remembered_scopes) {
+        trace_scope(env);
+    }
+
+    for (gem_value value : gem_remembered_values) {
+        mark_value(value);
+    }
+
+    collecting_young = false;
+
+    size_t promoted = promote_nursery(gem_nursery_objects, gem_heap_objects) +
+                      promote_nursery(gem_nursery_closures, gem_heap_closures);
+    forget_remembered();
+
+    gc_statistics.young_collections++;
+    gc_statistics.promoted_bytes += promoted;
+    gc_statistics.old_bytes += promoted;
+
+    gc_log("young collection of " +
+           std::to_string(gc_statistics.nursery_bytes) + " bytes, promoted " +
+           std::to_string(promoted) + ", old generation " +
+           std::to_string(gc_statistics.old_bytes) + "/" +
+           std::to_string(gc_statistics.full_threshold));
+    gc_statistics.nursery_bytes = 0;
+}
+
+// marks both generations and leaves the old one to be swept lazily
+static void start_full_collection() {
+    while (sweeping) {
+        sweep_step(SIZE_MAX);
+    }
+
+    gc_log("full collection, old generation " +
+           std::to_string(gc_statistics.old_bytes) + "/" +
+           std::to_string(gc_statistics.full_threshold) + " bytes");
+
+    mark_roots();
+
+    sweeping = true;
+    promote_nursery(gem_nursery_objects, gem_heap_objects);
+    promote_nursery(gem_nursery_closures, gem_heap_closures);
+    forget_remembered();
+
+    gc_statistics.full_collections++;
+    gc_statistics.nursery_bytes = 0;
+    sweep_live_bytes = 0;
+    sweep_objects_read = sweep_objects_write = 0;
+    sweep_closures_read = sweep_closures_write = 0;
+}
+
+void gc_step(size_t bytes) {
+    if (sweeping) {
+        sweep_step(std::max<size_t>(
+            gc_sweep_step * gc_settings.step_multiplier / 100, 1));
+    }
+
+    gc_statistics.nursery_bytes += bytes;
+    if (gc_statistics.nursery_bytes <= gc_settings.nursery_bytes ||
+        gc_paused > 0) {
+        return;
+    }
+
+    collect_young();
+
+    if (!sweeping &&
+        gc_statistics.old_bytes > gc_statistics.full_threshold) {
+        start_full_collection();
+    }
+}
+
+void push_heap_closures(scope *closure) {
+    gc_step(sizeof(scope));
+    gem_nursery_closures.push_back(closure);
+}
+
+gem_value make_string(const std::string &string) {
+    auto interned = gem_strings.find(string);
+    if (interned != gem_strings.end()) {
+        gem_object *object = interned->second;
+        // an old string that was found dead by the last mark can still be
+        // waiting for the sweeper, marking it keeps it alive. if it was
+        // already swept it just survives one more full collection
+        if (sweeping && object->old) {
+            object->marked = true;
         }
+        return gem_value::object(object);
+    }
+
+    gem_object *object =
+        make_object(gem_type::gem_string, nullptr, string.size());
+    object->string = string;
+    object->hash = std::hash<std::string_view>{}(object->string);
+    gem_strings.emplace(object->string, object);
+    return gem_value::object(object);
+}
+
+static bool parse_size(const std::string &text, size_t &result) {
+    if (text.empty()) {
+        return false;
     }
 
-    std::cout << "There is " << gem_heap_objects.size() << " objects and "
-              << gem_heap_closures.size() << " closures." << std::endl;
+    char *end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (*end != '\0') {
+        return false;
+    }
 
-    std::cout << "Deleted " << objects_deleted << " objects and "
-              << closure_deleted << " closures." << std::endl;
+    result = value;
+    return true;
 }
 
-std::string gem_hash_tostring(gem_value *value) {
-    switch (value->value_type) {
-    case gem_type::gem_number:
-        return "n" + std::to_string(value->number);
-    case gem_type::gem_string:
-        return "s" + value->string;
-    case gem_type::gem_bool:
-        return "b" + std::to_string(value->boolean);
-    case gem_type::gem_table: {
-        std::stringstream ss;
-        ss << value->table;
-        return "t" + ss.str();
+bool gc_set_option(const std::string &name, const std::string &value) {
+    if (name == "nursery") {
+        return parse_size(value, gc_settings.nursery_bytes);
+    } else if (name == "pause") {
+        return parse_size(value, gc_settings.pause);
+    } else if (name == "stepmul") {
+        return parse_size(value, gc_settings.step_multiplier);
+    } else if (name == "log") {
+        gc_settings.log = value != "0";
+        return true;
     }
-    case gem_type::gem_function: {
-        std::stringstream ss;
-        ss << value->func;
-        return "f" + ss.str();
+
+    return false;
+}
+
+// GEM_GC_NURSERY, GEM_GC_PAUSE, GEM_GC_STEPMUL and GEM_GC_LOG
+void gc_configure_from_env() {
+    for (const char *name : {"nursery", "pause", "stepmul", "log"}) {
+        std::string variable = "GEM_GC_" + std::string(name);
+        std::transform(
+            variable.begin(), variable.end(), variable.begin(), ::toupper);
+
+        const char *value = std::getenv(variable.c_str());
+        if (value && !gc_set_option(name, value)) {
+            std::cerr << "Invalid value for " << variable << ": " << value
+                      << std::endl;
+            exit(1);
+        }
     }
-    case gem_type::gem_null:
-        return "";
-    default:
-        return "";
+}
+
+void gc_print_stats(std::ostream &out) {
+    out << "young collections: " << gc_statistics.young_collections << "\n"
+        << "full collections: " << gc_statistics.full_collections << "\n"
+        << "old generation: " << gc_statistics.old_bytes << " bytes\n"
+        << "live after last full collection: " << gc_statistics.live_bytes
+        << " bytes\n"
+        << "next full collection at: " << gc_statistics.full_threshold
+        << " bytes\n"
+        << "promoted: " << gc_statistics.promoted_bytes << " bytes\n"
+        << "freed: " << gc_statistics.freed_cells << " cells\n"
+        << "slabs: " << gem_slabs.reserved_bytes() << " bytes" << std::endl;
+}
+
+void garbage_collect() {
+    size_t before = gem_heap_objects.size() + gem_nursery_objects.size();
+    size_t closures_before =
+        gem_heap_closures.size() + gem_nursery_closures.size();
+
+    start_full_collection();
+    while (sweeping) {
+        sweep_step(SIZE_MAX);
     }
-}
\ No newline at end of file
+
+    gc_log("full collection kept " + std::to_string(gem_heap_objects.size()) +
+           " objects and " + std::to_string(gem_heap_closures.size()) +
+           " closures, freed " +
+           std::to_string(before - gem_heap_objects.size()) + " objects and " +
+           std::to_string(closures_before - gem_heap_closures.size()) +
+           " closures");
+}
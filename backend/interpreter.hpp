@@ -1,17 +1,24 @@
 #pragma once
 #include "./magic_enum/magic_enum.hpp"
 #include "parser.hpp"
+#include "slab.hpp"
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <span>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
-extern u_int64_t MAX_ALLOCATIONS;
-
-inline u_int64_t allocations = 0;
 
 class scope;
+struct gem_table;
+struct function;
 
 enum class gem_type {
     gem_number,
@@ -27,6 +34,7 @@ enum class gem_function_type {
     native_function,
     default_function,
     metadata_function,
+    bytecode_function,
 };
 
 static std::string gem_type_tostring(gem_type value_type) {
@@ -48,166 +56,462 @@ static std::string gem_type_tostring(gem_type value_type) {
     }
 }
 
-struct gem_value;
+struct gem_object;
+
+// every value is nan boxed into 64 bits. doubles are stored as they are,
+// null, booleans and pointers to gc objects live in the payload of a quiet
+// nan, so numbers and booleans never touch the heap
+class gem_value {
+  public:
+    gem_value() : bits(quiet_nan | null_tag) {}
+
+    static gem_value number(double number) {
+        gem_value value;
+        // canonicalize so no computed nan can look like a boxed value
+        value.bits = number != number ? canonical_nan
+                                      : std::bit_cast<uint64_t>(number);
+        return value;
+    }
+
+    static gem_value boolean(bool boolean) {
+        gem_value value;
+        value.bits = quiet_nan | (boolean ? true_tag : false_tag);
+        return value;
+    }
+
+    static gem_value null() {
+        return gem_value();
+    }
+
+    // marks a global slot that has not been defined yet
+    static gem_value empty() {
+        gem_value value;
+        value.bits = quiet_nan | empty_tag;
+        return value;
+    }
+
+    static gem_value object(gem_object *object) {
+        gem_value value;
+        value.bits = sign_bit | quiet_nan | uint64_t(uintptr_t(object));
+        return value;
+    }
+
+    bool is_number() const {
+        return (bits & quiet_nan) != quiet_nan;
+    }
+
+    bool is_null() const {
+        return bits == (quiet_nan | null_tag);
+    }
 
-std::string gem_hash_tostring(gem_value *value);
+    bool is_bool() const {
+        return (bits | 1) == (quiet_nan | true_tag);
+    }
+
+    bool is_empty() const {
+        return bits == (quiet_nan | empty_tag);
+    }
 
-inline unsigned long hash_string(const std::string &str) {
-    unsigned long hash = 5381;
-    for (unsigned char c : str)
-        hash = ((hash << 5) + hash) + c;
-    return hash;
+    bool is_object() const {
+        return (bits & (sign_bit | quiet_nan)) == (sign_bit | quiet_nan);
+    }
+
+    double as_number() const {
+        return std::bit_cast<double>(bits);
+    }
+
+    bool as_bool() const {
+        return bits == (quiet_nan | true_tag);
+    }
+
+    gem_object *as_object() const {
+        return (gem_object *)uintptr_t(bits & ~(sign_bit | quiet_nan));
+    }
+
+    inline gem_type type() const;
+    inline const std::string &as_string() const;
+    inline gem_table *as_table() const;
+    inline function *as_function() const;
+
+    uint64_t raw() const {
+        return bits;
+    }
+
+    bool operator==(const gem_value &other) const {
+        return bits == other.bits;
+    }
+
+  private:
+    static constexpr uint64_t sign_bit = 0x8000000000000000;
+    static constexpr uint64_t quiet_nan = 0x7ffc000000000000;
+    static constexpr uint64_t canonical_nan = 0x7ff8000000000000;
+    static constexpr uint64_t null_tag = 1;
+    static constexpr uint64_t false_tag = 2;
+    static constexpr uint64_t true_tag = 3;
+    static constexpr uint64_t empty_tag = 4;
+
+    uint64_t bits;
 };
 
-struct gem_entry {
-    std::string key;
-    gem_value *value;
-    gem_entry *next;
+static_assert(sizeof(gem_value) == 8);
+
+// table keys are compared by identity, strings can be since every string is
+// interned. numbers are compared by value so 0 and -0 are the same key
+inline size_t gem_hash(gem_value key);
+
+inline bool gem_keys_equal(gem_value a, gem_value b) {
+    return a == b ||
+           (a.is_number() && b.is_number() && a.as_number() == b.as_number());
+}
+
+inline size_t hash_bits(uint64_t bits) {
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccd;
+    bits ^= bits >> 33;
+    return bits;
+}
+
+// slot of the hash part, free slots have an empty key
+struct gem_node {
+    gem_value key = gem_value::empty();
+    gem_value value;
 };
 
-struct gem_table {
-    std::vector<gem_value *> array;
-    std::vector<gem_entry *> buckets;
+// array part of a table. a ring buffer with a power of two capacity, so
+// values can be pushed and popped at both ends without moving the others
+class gem_array {
+  public:
+    size_t size() const {
+        return count;
+    }
 
-    size_t hash_capacity;
-    size_t hash_size;
+    bool empty() const {
+        return count == 0;
+    }
+
+    size_t capacity() const {
+        return values.size();
+    }
+
+    gem_value &operator[](size_t index) {
+        return values[(head + index) & (values.size() - 1)];
+    }
+
+    void push_back(gem_value value) {
+        if (count == values.size()) {
+            reserve(count + 1);
+        }
+        (*this)[count++] = value;
+    }
+
+    void push_front(gem_value value) {
+        if (count == values.size()) {
+            reserve(count + 1);
+        }
+        head = (head - 1) & (values.size() - 1);
+        values[head] = value;
+        count++;
+    }
+
+    gem_value pop_back() {
+        gem_value value = (*this)[--count];
+        (*this)[count] = gem_value::null();
+        shrink();
+        return value;
+    }
+
+    gem_value pop_front() {
+        gem_value value = values[head];
+        values[head] = gem_value::null();
+        head = (head + 1) & (values.size() - 1);
+        count--;
+        shrink();
+        return value;
+    }
+
+    void resize(size_t size, gem_value fill) {
+        if (size > values.size()) {
+            reserve(size);
+        }
+        for (size_t index = count; index < size; index++) {
+            (*this)[index] = fill;
+        }
+        for (size_t index = size; index < count; index++) {
+            (*this)[index] = gem_value::null();
+        }
+        count = size;
+    }
+
+  private:
+    std::vector<gem_value> values;
+    size_t head = 0;
+    size_t count = 0;
 
-    inline void push_back(gem_value *value) {
+    // moves the values to a buffer of at least size slots, starting at 0
+    void reserve(size_t size) {
+        size_t new_capacity = 8;
+        while (new_capacity < size) {
+            new_capacity *= 2;
+        }
+
+        std::vector<gem_value> moved(new_capacity, gem_value::null());
+        for (size_t index = 0; index < count; index++) {
+            moved[index] = (*this)[index];
+        }
+
+        values = std::move(moved);
+        head = 0;
+    }
+
+    void shrink() {
+        if (values.size() > 8 && count < values.size() / 4) {
+            reserve(values.size() / 2);
+        }
+    }
+};
+
+// hidden class of a table, stands for the keys of its hash part in the order
+// they were inserted. the hash part is filled deterministically, so tables
+// with the same shape keep every key in the same node and a member lookup can
+// be cached per shape. tables that outgrow the limits in shape_transition go
+// to dictionary mode, a null shape, and are never cached
+struct gem_shape {
+    std::unordered_map<uint64_t, gem_shape *> transitions;
+    size_t key_count = 0;
+};
+
+inline gem_shape gem_root_shape;
+
+// the shape after key was added to a table with the given one
+gem_shape *shape_transition(gem_shape *shape, gem_value key);
+
+// lua style table: whole numbers below the size of the array part index it,
+// every other key lives in an open addressed hash part with linear probing.
+// the array part only grows by appending, so sparse and fractional number
+// keys go to the hash part. keys are never removed, so the hash part needs
+// no tombstones. nan is never a key, the interpreters reject it
+struct gem_table {
+    gem_array array;
+    std::vector<gem_node> nodes;
+    size_t hash_size = 0;
+    gem_shape *shape = &gem_root_shape;
+
+    inline void push_back(gem_value value) {
         array.push_back(value);
     };
 
-    inline void push_front(gem_value *value) {
-        array.insert(array.begin(), value);
+    inline void push_front(gem_value value) {
+        array.push_front(value);
     };
 
-    inline gem_value *pop_back() {
+    inline gem_value pop_back() {
         if (array.empty())
-            return nullptr;
-        gem_value *value = array.back();
-        array.pop_back();
-        return value;
+            return gem_value::null();
+        return array.pop_back();
     };
 
-    inline gem_value *pop_front() {
+    inline gem_value pop_front() {
         if (array.empty())
-            return nullptr;
-        gem_value *value = array.front();
-        array.erase(array.begin());
-        return value;
+            return gem_value::null();
+        return array.pop_front();
     };
 
-    inline gem_value *hash_at(gem_value *key) {
-        std::string hashed_key = gem_hash_tostring(key);
+    inline int node_index(gem_value key) {
+        if (nodes.empty()) {
+            return -1;
+        }
 
-        unsigned long h = hash_string(hashed_key);
-        size_t idx = h % hash_capacity;
+        size_t mask = nodes.size() - 1;
+        size_t idx = gem_hash(key) & mask;
 
-        gem_entry *entry = buckets[idx];
-        while (entry) {
-            if (entry->key == hashed_key) {
-                return entry->value;
+        while (!nodes[idx].key.is_empty()) {
+            if (gem_keys_equal(nodes[idx].key, key)) {
+                return int(idx);
             }
-            entry = entry->next;
+            idx = (idx + 1) & mask;
         }
 
-        return nullptr;
+        return -1;
     };
 
-    inline void resize_and_rehash() {
-        size_t new_capacity = hash_capacity * 2;
-        std::vector<gem_entry *> new_buckets(new_capacity, nullptr);
+    // the pointer is only valid until the next hash_make
+    inline gem_value *hash_at(gem_value key) {
+        int index = node_index(key);
+        return index < 0 ? nullptr : &nodes[index].value;
+    };
 
-        for (gem_entry *old_bucket : buckets) {
-            gem_entry *entry = old_bucket;
-            while (entry) {
-                gem_entry *next = entry->next;
+    inline bool in_array(double number) {
+        return number >= 0 && number < double(array.size()) &&
+               number == std::floor(number);
+    }
 
-                unsigned long h = hash_string(entry->key);
-                size_t idx = h % new_capacity;
+    // the pointer is only valid until the table is changed
+    inline gem_value *at(gem_value key) {
+        if (key.is_number() && in_array(key.as_number())) {
+            return &array[size_t(key.as_number())];
+        }
+        return hash_at(key);
+    }
 
-                entry->next = new_buckets[idx];
-                new_buckets[idx] = entry;
+    inline void set(gem_value key, gem_value value) {
+        if (key.is_number()) {
+            double number = key.as_number();
+            if (in_array(number)) {
+                array[size_t(number)] = value;
+                return;
+            }
 
-                entry = next;
+            // a key that was put in the hash part before the array reached
+            // it stays there
+            if (number == double(array.size()) && hash_at(key) == nullptr) {
+                array.push_back(value);
+                return;
             }
         }
 
-        buckets = std::move(new_buckets);
-        hash_capacity = new_capacity;
+        hash_make(key, value);
+    }
+
+    inline void resize_and_rehash() {
+        std::vector<gem_node> old_nodes = std::move(nodes);
+        nodes.assign(old_nodes.empty() ? 4 : old_nodes.size() * 2, gem_node{});
+
+        size_t mask = nodes.size() - 1;
+        for (gem_node &node : old_nodes) {
+            if (node.key.is_empty()) {
+                continue;
+            }
+
+            size_t idx = gem_hash(node.key) & mask;
+            while (!nodes[idx].key.is_empty()) {
+                idx = (idx + 1) & mask;
+            }
+            nodes[idx] = node;
+        }
     };
 
-    inline gem_value *hash_make(gem_value *key, gem_value *value) {
-        if (hash_size > hash_capacity * 0.75) {
+    inline gem_value hash_make(gem_value key, gem_value value) {
+        if ((hash_size + 1) * 4 > nodes.size() * 3) {
             resize_and_rehash();
         };
 
-        std::string hashed_key = gem_hash_tostring(key);
-
-        unsigned long h = hash_string(hashed_key);
-        size_t idx = h % hash_capacity;
+        size_t mask = nodes.size() - 1;
+        size_t idx = gem_hash(key) & mask;
 
-        gem_entry *entry = buckets[idx];
-        while (entry) {
-            if (entry->key == hashed_key) {
-                entry->value = value;
-                return entry->value;
+        while (!nodes[idx].key.is_empty()) {
+            if (gem_keys_equal(nodes[idx].key, key)) {
+                nodes[idx].value = value;
+                return value;
             }
-            entry = entry->next;
+            idx = (idx + 1) & mask;
         }
 
-        gem_entry *new_entry = new gem_entry{hashed_key, value, buckets[idx]};
-        buckets[idx] = new_entry;
+        nodes[idx] = gem_node{key, value};
         hash_size++;
+        shape = shape ? shape_transition(shape, key) : nullptr;
 
-        return new_entry->value;
+        return value;
     };
 
-    ~gem_table() {
-        for (auto head : buckets) {
-            gem_entry *entry = head;
-            while (entry) {
-                gem_entry *next = entry->next;
-                delete entry;
-                entry = next;
-            }
-        }
-    };
+    GEM_SLAB_ALLOCATED
+};
 
-    gem_table() {
-        hash_capacity = 16;
-        buckets.resize(hash_capacity, nullptr);
-        hash_size = 0;
-    }
+struct gem_proto;
+
+// a variable captured by a closure, location points into the stack or frame
+// of its function while the variable is alive and to closed once it exits
+struct gem_upvalue {
+    gem_value *location;
+    gem_value closed;
+};
+
+// where a closure finds an upvalue when it is made, a slot of the enclosing
+// function or one of the upvalues of the enclosing closure
+struct upvalue_info {
+    bool in_stack;
+    uint16_t index;
+};
+
+// what every closure of one tree-walker function declaration shares, made
+// once per declaration site by the resolver
+struct function_prototype {
+    // the body, in the ast of the program
+    node_list body;
+    int param_count = 0;
+    // params come first, the locals of its loops follow the ones of the body
+    int slot_count = 0;
+    std::vector<upvalue_info> upvalues{};
+};
+
+// closures point into it, a deque so it never moves
+inline std::deque<function_prototype> gem_prototypes;
+
+// natives read their arguments in place, from the value stack of the
+// tree-walker or the registers of the vm
+using native_caller = gem_value (*)(gem_value self,
+    std::span<const gem_value> args,
+    scope *env,
+    u_int64_t line);
+
+// parameter types of a native, a constant given when it is registered.
+// methods take the value they are called on as self, unless it is passed as
+// the first argument like in table.push_back(t, x)
+struct native_signature {
+    static constexpr size_t max_params = 4;
+
+    bool method = false;
+    gem_type self = gem_type::gem_any;
+    std::array<gem_type, max_params> params{};
+    size_t param_count = 0;
+    // arguments past params are passed on unchecked
+    bool variadic = false;
 };
 
 struct function {
     gem_function_type function_type;
-    std::vector<std::string> params;
-    std::vector<std::shared_ptr<astToken>> body;
+    const function_prototype *prototype = nullptr;
     scope *declaration_enviroment = nullptr;
-    gem_value *(*caller)(
-        std::vector<gem_value *>, scope *env, u_int64_t line) = nullptr;
+    native_caller caller = nullptr;
+    const native_signature *signature = nullptr;
+    gem_proto *proto = nullptr;
+    std::vector<std::shared_ptr<gem_upvalue>> upvalues;
 };
 
-struct gem_value {
+// every live string, keyed by its own characters. make_string hands out the
+// existing cell for equal contents and a string leaves the table when the gc
+// frees it, so equal strings are always the same gem_object
+inline std::unordered_map<std::string_view, gem_object *> gem_strings;
+
+// heap cell behind every string, table and function value
+struct gem_object {
     gem_type value_type = gem_type::gem_null;
     union {
-        double number;
         std::string string;
-        bool boolean;
         gem_table *table;
         function *func;
     };
     bool marked = false;
+    // survived a collection and lives in the old generation
+    bool old = false;
+    // old and already in gem_remembered_objects
+    bool remembered = false;
+    // hash of the contents of a string, computed once when it is interned
+    size_t hash = 0;
     scope *declaration_env = nullptr;
 
     gem_table *metadata = nullptr;
 
-    gem_value() {};
+    gem_object() {};
+
+    GEM_SLAB_ALLOCATED
 
-    ~gem_value() {
-        if (value_type == gem_type::gem_string)
+    ~gem_object() {
+        if (value_type == gem_type::gem_string) {
+            auto interned = gem_strings.find(string);
+            if (interned != gem_strings.end() && interned->second == this)
+                gem_strings.erase(interned);
             string.~basic_string();
+        }
         else if (value_type == gem_type::gem_function)
             delete func;
         else if (value_type == gem_type::gem_table)
@@ -215,57 +519,243 @@ struct gem_value {
     };
 };
 
+inline gem_type gem_value::type() const {
+    if (is_number())
+        return gem_type::gem_number;
+    if (is_object())
+        return as_object()->value_type;
+    if (is_bool())
+        return gem_type::gem_bool;
+    return gem_type::gem_null;
+}
+
+inline const std::string &gem_value::as_string() const {
+    return as_object()->string;
+}
+
+inline gem_table *gem_value::as_table() const {
+    return as_object()->table;
+}
+
+inline function *gem_value::as_function() const {
+    return as_object()->func;
+}
+
+inline size_t gem_hash(gem_value key) {
+    if (key.type() == gem_type::gem_string) {
+        return key.as_object()->hash;
+    }
+
+    if (key.is_number() && key.as_number() == 0) {
+        return hash_bits(0);
+    }
+
+    return hash_bits(key.raw());
+}
+
+// inline cache of one member expression site. shape is the shape of the
+// table it last resolved, metadata is null when the key was found in the
+// table itself, otherwise the metadata table and its shape
+struct member_cache {
+    gem_shape *shape = nullptr;
+    gem_table *metadata = nullptr;
+    gem_shape *metadata_shape = nullptr;
+    int index = 0;
+};
+
+inline bool member_cache_hit(
+    member_cache &cache, gem_object *object, gem_value &result) {
+    gem_table *table = object->table;
+    if (table->shape == nullptr || table->shape != cache.shape) {
+        return false;
+    }
+
+    if (cache.metadata == nullptr) {
+        result = table->nodes[cache.index].value;
+        return true;
+    }
+
+    gem_table *metadata = object->metadata;
+    if (metadata != cache.metadata || metadata->shape != cache.metadata_shape) {
+        return false;
+    }
+
+    result = metadata->nodes[cache.index].value;
+    return true;
+}
+
+// remembers where key was found, called after a lookup on the slow path
+void member_cache_fill(member_cache &cache, gem_object *object, gem_value key);
+
+// caches of the tree-walker member expressions, numbered by the resolver
+inline std::vector<member_cache> gem_member_caches;
+
+// the heap is split in two generations. everything is allocated in the
+// nursery, a young collection frees the unreachable part of it and promotes
+// the rest to the old generation, which is only marked when it has grown
+// past gc_stats::full_threshold and then swept a few cells per allocation.
 inline std::vector<scope *> gem_heap_closures;
-inline std::vector<gem_value *> gem_heap_objects;
+inline std::vector<gem_object *> gem_heap_objects;
+inline std::vector<scope *> gem_nursery_closures;
+inline std::vector<gem_object *> gem_nursery_objects;
+
+// old cells that had a young value stored in them since the last young
+// collection, they are scanned as roots by it
+inline std::vector<gem_object *> gem_remembered_objects;
+inline std::vector<scope *> gem_remembered_scopes;
+// young values stored in places that are not gc cells, like closed upvalues
+inline std::vector<gem_value> gem_remembered_values;
+
+// values that only live on the c++ stack of the tree-walker, see temp_roots
+inline std::vector<gem_value> gem_temp_roots;
+inline int gc_paused = 0;
+
+// pacing knobs, in the spirit of lua's setpause and setstepmul. set from the
+// command line or GEM_GC_* environment variables through gc_set_option
+struct gc_config {
+    // bytes allocated in the nursery before a young collection
+    size_t nursery_bytes = 256 * 1024;
+    // the next full collection starts when the old generation reaches
+    // pause% of the bytes that were live after the last one
+    size_t pause = 200;
+    // old cells swept per allocation, in % of gc_sweep_step
+    size_t step_multiplier = 100;
+    // print every pacing decision to stderr
+    bool log = false;
+};
+
+struct gc_stats {
+    size_t young_collections = 0;
+    size_t full_collections = 0;
+    // bytes allocated since the last young collection
+    size_t nursery_bytes = 0;
+    // estimated size of the old generation
+    size_t old_bytes = 0;
+    // old generation size right after the last full mark
+    size_t live_bytes = 0;
+    // old_bytes that start the next full collection
+    size_t full_threshold = 1024 * 1024;
+    size_t promoted_bytes = 0;
+    size_t freed_cells = 0;
+};
+
+inline gc_config gc_settings;
+inline gc_stats gc_statistics;
+
+bool gc_set_option(const std::string &name, const std::string &value);
+void gc_configure_from_env();
+void gc_print_stats(std::ostream &out);
 
 void mark_scope(scope *env);
-void mark_value(gem_value *value);
+void mark_object(gem_object *object);
+
+inline void mark_value(gem_value value) {
+    if (value.is_object()) {
+        mark_object(value.as_object());
+    }
+}
+
+// extra root sets that live outside of the scope tree, like the bytecode vm
+// registers, they get called on every collection
+inline std::vector<void (*)()> gc_roots;
 
 void garbage_collect();
+void collect_young();
+void gc_step(size_t bytes);
 
-inline void push_heap_closures(scope *closure) {
-    gem_heap_closures.push_back(closure);
-    allocations++;
+inline bool is_young(gem_value value) {
+    return value.is_object() && !value.as_object()->old;
+}
 
-    if (allocations > MAX_ALLOCATIONS) {
-        allocations = 0;
-        garbage_collect();
+// has to run before a value is stored in a table or a function
+inline void write_barrier(gem_object *container, gem_value value) {
+    if (container->old && !container->remembered && is_young(value)) {
+        container->remembered = true;
+        gem_remembered_objects.push_back(container);
     }
+}
+
+inline void remember_value(gem_value value) {
+    if (is_young(value)) {
+        gem_remembered_values.push_back(value);
+    }
+}
+
+// gc_step runs before the cell is registered, so a collection never sees a
+// cell that its caller could not have rooted yet
+void push_heap_closures(scope *closure);
+
+inline void push_heap_objects(gem_object *object, size_t bytes) {
+    gc_step(bytes);
+    gem_nursery_objects.push_back(object);
 };
 
-inline void push_heap_objects(gem_value *object) {
-    gem_heap_objects.push_back(object);
-    allocations++;
+size_t object_bytes(gem_type object_type);
+
+// only strings, tables and functions are allocated, everything else is an
+// immediate gem_value. payload is the size of a string's characters
+inline gem_object *make_object(
+    gem_type object_type, scope *env = nullptr, size_t payload = 0) {
+    gem_object *object = new gem_object{};
+    object->value_type = object_type;
+    object->declaration_env = env;
 
-    if (allocations > MAX_ALLOCATIONS) {
-        allocations = 0;
-        garbage_collect();
+    if (object_type == gem_type::gem_string) {
+        new (&object->string) std::string();
     }
+    push_heap_objects(object, object_bytes(object_type) + payload);
+
+    return object;
 };
 
-inline gem_value *make_value(
-    gem_type value_type, bool marked = false, scope *env = nullptr) {
-    gem_value *value = new gem_value{};
-    value->marked = marked;
-    value->value_type = value_type;
-    value->declaration_env = env;
+// returns the interned cell for the contents, only allocates the first time
+gem_value make_string(const std::string &string);
+
+// strings interned by the resolver for the literals and property names of
+// the ast, they stay rooted for the whole run
+inline std::vector<gem_value> gem_constants;
+
+// keeps tree-walker temporaries alive until the guard goes out of scope
+class temp_roots {
+  public:
+    temp_roots() : mark(gem_temp_roots.size()) {}
+
+    ~temp_roots() {
+        gem_temp_roots.resize(mark);
+    }
 
-    if (value_type == gem_type::gem_string) {
-        new (&value->string) std::string();
+    void push(gem_value value) {
+        if (value.is_object()) {
+            gem_temp_roots.push_back(value);
+        }
     }
-    push_heap_objects(value);
 
-    return value;
+  private:
+    size_t mark;
+};
+
+// no collection runs while a guard is alive, used while natives are built
+struct gc_pause {
+    gc_pause() {
+        gc_paused++;
+    }
+
+    ~gc_pause() {
+        gc_paused--;
+    }
 };
 
 class scope {
   public:
     std::string file_name;
     scope *parent_env = nullptr;
-    std::unordered_map<std::string, gem_value *> stack;
-    std::vector<scope*> closures;
+    std::unordered_map<std::string, gem_value> stack;
+    // stable pointers into the stack of the root scope, see resolver
+    std::vector<gem_value *> global_slots;
     bool marked = false;
     bool alive = false;
+    bool old = false;
+    bool remembered = false;
 
     scope(bool should_allocate = true) {
         if (should_allocate == true) {
@@ -276,6 +766,8 @@ class scope {
     ~scope() {
     }
 
+    GEM_SLAB_ALLOCATED
+
   public:
     scope *resolve(const std::string &identifier) {
         if (stack.find(identifier) != stack.end()) {
@@ -287,41 +779,61 @@ class scope {
         }
     }
 
-    gem_value *get_variable(const std::string &identifier) {
+    gem_value get_variable(const std::string &identifier) {
         scope *enviroment = resolve(identifier);
-        return !enviroment ? get_variable("null")
-                           : enviroment->stack[identifier];
+        if (!enviroment) {
+            return gem_value::null();
+        }
+
+        gem_value value = enviroment->stack[identifier];
+        return value.is_empty() ? gem_value::null() : value;
     }
 
-    gem_value *make_variable(const std::string &identifier, gem_value *value) {
+    // has to run before a value is stored in this scope
+    void write_barrier(gem_value value) {
+        if (old && !remembered && is_young(value)) {
+            remembered = true;
+            gem_remembered_scopes.push_back(this);
+        }
+    }
+
+    gem_value make_variable(const std::string &identifier, gem_value value) {
+        write_barrier(value);
         this->stack[identifier] = value;
         return value;
     }
 
-    gem_value *set_variable(const std::string &identifier, gem_value *value) {
+    bool set_variable(const std::string &identifier, gem_value value) {
         scope *env = this->resolve(identifier);
-        if (env == nullptr) {
-            return nullptr;
+        if (env == nullptr || env->stack[identifier].is_empty()) {
+            return false;
         };
 
+        env->write_barrier(value);
         env->stack[identifier] = value;
-        return value;
+        return true;
     }
 };
 
-struct abstract_node {
-    gem_value *value;
-    virtual ~abstract_node() = default;
-};
+// how a statement finished, loops and calls check it to unwind
+enum class completion_type { normal, returned, broke, continued };
 
-struct number_literal : public abstract_node {};
-struct string_literal : public abstract_node {};
-struct boolean_literal : public abstract_node {};
-struct table_literal : public abstract_node {};
-struct return_literal : public abstract_node {};
-struct continue_literal : public abstract_node {};
-struct break_literal : public abstract_node {};
+// result of interpreting a node, returned by value
+struct completion {
+    gem_value value;
+    completion_type type = completion_type::normal;
+};
 
-std::unique_ptr<abstract_node> interpret(astToken &node, scope *env);
+bool is_truthy(gem_value value);
+completion interpret(node_index node, scope *env);
+// binds self and checks the arguments against the signature of the native,
+// receiver is empty when the callee was not looked up on a value
+gem_value call_native(function *callee,
+    gem_value receiver,
+    std::span<const gem_value> args,
+    scope *env,
+    u_int64_t line);
+completion interpret_program(
+    ast &program, const function_prototype *main, scope *env);
 
 extern scope *root;
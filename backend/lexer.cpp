@@ -1,33 +1,50 @@
 #include "lexer.hpp"
 #include "debugger.hpp"
 
-#include <cstring>
-#include <deque>
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <iostream>
-#include <map>
-#include <sstream>
 #include <unordered_map>
-#include <variant>
-#include <vector>
 
-std::vector<std::string> splitString(const std::string &sourceCode) {
-    std::vector<std::string> words;
-
-    for (size_t i = 0; i < sourceCode.length(); i++) {
-        words.push_back(std::string(1, sourceCode[i]));
+enum char_class : uint8_t {
+    whitespace_char = 1 << 0,
+    // starts and continues an identifier or keyword
+    alpha_char = 1 << 1,
+    // starts a number literal
+    digit_char = 1 << 2,
+    // continues a number literal
+    number_char = 1 << 3,
+};
+
+constexpr std::array<uint8_t, 256> char_classes = [] {
+    std::array<uint8_t, 256> classes{};
+
+    for (unsigned char c : std::string_view(" \t\n\v\f\r")) {
+        classes[c] |= whitespace_char;
+    }
+    for (unsigned char c = 'a'; c <= 'z'; c++) {
+        classes[c] |= alpha_char;
+    }
+    for (unsigned char c = 'A'; c <= 'Z'; c++) {
+        classes[c] |= alpha_char;
+    }
+    for (unsigned char c = '0'; c <= '9'; c++) {
+        classes[c] |= digit_char | number_char;
     }
+    classes['_'] |= alpha_char | number_char;
+    classes['e'] |= number_char;
+    classes['.'] |= number_char;
 
-    return words;
-}
+    return classes;
+}();
 
-std::string shift(std::deque<std::string> &src) {
-    std::string value = src.front();
-    src.pop_front();
-    return value;
+inline bool is_char(char c, uint8_t char_class) {
+    return char_classes[static_cast<unsigned char>(c)] & char_class;
 }
 
 lexer_token token(
-    std::string value, TokenType type, int line = 0, int column = 1) {
+    std::string_view value, TokenType type, int line = 0, int column = 1) {
     lexer_token token;
     token.type = type;
     token.value = value;
@@ -36,18 +53,8 @@ lexer_token token(
     return token;
 }
 
-bool isNumber(std::string x) {
-    std::string matches = "0123456789e._";
-    return matches.find(x) != std::string::npos;
-}
-
-bool isAlpha(std::string x) {
-    std::string matches =
-        "qwertyuiopasdfghjklzxcvbnmQWERTYUIOPASDFGHJKLZXCVBNM_";
-    return matches.find(x) != std::string::npos;
-}
-
-std::unordered_map<std::string, TokenType> keywords = {{"var", TokenType::Var},
+std::unordered_map<std::string_view, TokenType> keywords = {
+    {"var", TokenType::Var},
     {"if", TokenType::IfStmt},
     {"fn", TokenType::Function},
     {"else", TokenType::Keyword},
@@ -64,258 +71,227 @@ std::unordered_map<std::string, TokenType> keywords = {{"var", TokenType::Var},
     {"true", TokenType::Boolean},
     {"false", TokenType::Boolean}};
 
-bool isStringBody(std::string x) {
-    return x == "'" || x == "`" || x == "\"";
+bool isStringBody(char x) {
+    return x == '\'' || x == '`' || x == '"';
 }
 
-bool isWhitespace(char x) {
-    return std::isspace(static_cast<unsigned char>(x));
-}
+lexer::lexer(std::string_view source, const std::string &file_name)
+    : src(source), file_name(file_name) {}
 
-bool isSpecialString(const std::string &str) {
-    for (char c : str) {
-        if (!std::isalnum(static_cast<unsigned char>(c))) {
-            return true;
+// skips over the characters of a token, keeping track of new lines
+void lexer::advance_to(size_t end) {
+    for (; cursor < end; cursor++) {
+        if (src[cursor] == '\n') {
+            line++;
+            line_start = cursor + 1;
         }
     }
-    return false;
 }
 
-std::vector<lexer_token> tokenize(
-    const std::string &sourceCode, const std::string &file_name) {
-    std::vector<lexer_token> tokens;
-    auto v = splitString(sourceCode + "\n");
-    std::deque<std::string> src = std::deque(v.begin(), v.end());
-    int line = 1;
-    int column = 1;
+lexer_token lexer::next() {
+    auto peek = [&](size_t offset) {
+        return cursor + offset < src.size() ? src[cursor + offset] : '\0';
+    };
 
-    std::string invalid_characters;
+    while (cursor < src.size() && is_char(src[cursor], whitespace_char)) {
+        advance_to(cursor + 1);
+    }
 
-    while (!src.empty()) {
-        std::string c = src.front();
-        column++;
-        if (c == "\n" || c == "\r") {
-            line++;
-            column = 1;
-        }
-        if (isWhitespace(c[0])) {
-            shift(src);
-            continue;
-        };
-
-        if (c == "(") {
-            tokens.push_back(
-                token(shift(src), TokenType::OpenParen, line, column));
-        }
+    if (cursor >= src.size()) {
+        // the source always ends with a virtual new line
+        return token("eof", TokenType::EndOfFile, line + 1, 1);
+    }
 
-        else if (c == ")") {
-            tokens.push_back(
-                token(shift(src), TokenType::CloseParen, line, column));
+    char c = src[cursor];
+    size_t start = cursor;
+    int start_line = line;
+    int column = start - line_start + 1;
+
+    auto make = [&](size_t length, TokenType type) {
+        cursor = start + length;
+        return token(src.substr(start, length), type, start_line, column);
+    };
+
+    switch (c) {
+    case '(':
+        return make(1, TokenType::OpenParen);
+    case ')':
+        return make(1, TokenType::CloseParen);
+    case '{':
+        return make(1, TokenType::OpenBrace);
+    case '}':
+        return make(1, TokenType::CloseBrace);
+    case '[':
+        return make(1, TokenType::OpenBracket);
+    case ']':
+        return make(1, TokenType::CloseBracket);
+    case '.':
+        return make(1, TokenType::Dot);
+    case ';':
+        return make(1, TokenType::SemiColon);
+    case ',':
+        return make(1, TokenType::Comma);
+    case ':':
+        return peek(1) == ':' ? make(2, TokenType::DoubleColon)
+                              : make(1, TokenType::Colon);
+    case '>':
+    case '<':
+    case '!':
+        return make(peek(1) == '=' ? 2 : 1, TokenType::ComparisonOperator);
+    case '=':
+        return peek(1) == '=' ? make(2, TokenType::ComparisonOperator)
+                              : make(1, TokenType::Equals);
+    case '-':
+        if (peek(1) == '>') {
+            return make(2, TokenType::Arrow);
         }
-
-        else if (c == "{") {
-            tokens.push_back(
-                token(shift(src), TokenType::OpenBrace, line, column));
+        [[fallthrough]];
+    case '+':
+    case '*':
+    case '/':
+    case '^':
+    case '%':
+        return peek(1) == '=' ? make(2, TokenType::Equals)
+                              : make(1, TokenType::BinaryOperator);
+    case '&':
+    case '|':
+        if (peek(1) == c) {
+            return make(2, TokenType::Keyword);
         }
+        break;
+    default:
+        break;
+    }
 
-        else if (c == "}") {
-            tokens.push_back(
-                token(shift(src), TokenType::CloseBrace, line, column));
+    if (isStringBody(c)) {
+        // escapes are kept as they are written, the quotes are part of the
+        // value
+        size_t end = cursor + 1;
+        while (end < src.size() && src[end] != c) {
+            end += src[end] == '\\' ? 2 : 1;
         }
 
-        else if (c == "[") {
-            tokens.push_back(
-                token(shift(src), TokenType::OpenBracket, line, column));
+        if (end >= src.size()) {
+            error(error_type::lexical_error,
+                add_pointers("^", std::string(1, c), 0, 0),
+                file_name,
+                start_line,
+                "Unterminated string literal!");
+            exit(1);
         }
 
-        else if (c == "]") {
-            tokens.push_back(
-                token(shift(src), TokenType::CloseBracket, line, column));
-        } else if (c == "-" && src[1] == ">") {
-            shift(src);
-            shift(src);
-            tokens.push_back(token("->", TokenType::Arrow, line, column));
-        } else if (c == ">" || c == "<" || c == "!") {
-            if (src[1] == "=") {
-                std::string op = shift(src);
-                shift(src);
-                tokens.push_back(token(
-                    op + "=", TokenType::ComparisonOperator, line, column));
-                continue;
-            }
+        advance_to(end + 1);
+        return token(src.substr(start, end + 1 - start),
+            TokenType::String,
+            start_line,
+            column);
+    }
 
-            tokens.push_back(
-                token(shift(src), TokenType::ComparisonOperator, line, column));
-        } else if (c == "=") {
-            if (src[1] == "=") {
-                shift(src);
-                shift(src);
-                tokens.push_back(
-                    token("==", TokenType::ComparisonOperator, line, column));
-                continue;
-            }
-            tokens.push_back(
-                token(shift(src), TokenType::Equals, line, column));
+    if (is_char(c, alpha_char)) {
+        size_t end = cursor;
+        while (end < src.size() && is_char(src[end], alpha_char)) {
+            end++;
         }
 
-        else if (c == "+" || c == "-" || c == "*" || c == "/" || c == "^" ||
-                 c == "%" || c == "!") {
-            if (src[1] == "=") {
-                std::string op = shift(src);
-                shift(src);
-                tokens.push_back(
-                    token(op + "=", TokenType::Equals, line, column));
-
-                continue;
-            }
-            tokens.push_back(
-                token(shift(src), TokenType::BinaryOperator, line, column));
-        }
+        auto found = keywords.find(src.substr(start, end - start));
+        return make(end - start,
+            found != keywords.end() ? found->second : TokenType::Identifier);
+    }
 
-        else if (c == ".") {
-            tokens.push_back(token(shift(src), TokenType::Dot, line, column));
+    if (is_char(c, digit_char)) {
+        size_t end = cursor;
+        while (end < src.size() && is_char(src[end], number_char)) {
+            end++;
         }
 
-        else if (c == ":") {
-            if (src[1] == ":") {
-                shift(src);
-                shift(src);
-                tokens.push_back(
-                    token("::", TokenType::DoubleColon, line, column));
-                continue;
-            };
-            tokens.push_back(token(shift(src), TokenType::Colon, line, column));
+        // underscores are separators, the parser drops them
+        std::string_view number = src.substr(start, end - start);
+        int len = number.size() - 1;
+
+        if (number[len] == 'e' || number[len] == '.' || number[len] == '_') {
+            error(error_type::lexical_error,
+                add_pointers("^", std::string(number), len, len),
+                file_name,
+                line,
+                "Invalid number literal!");
+            exit(1);
         }
 
-        else if (c == ";") {
-            tokens.push_back(
-                token(shift(src), TokenType::SemiColon, line, column));
+        int amnt_of_e = std::count(number.begin(), number.end(), 'e');
+        int amnt_of_dots = std::count(number.begin(), number.end(), '.');
+
+        if (amnt_of_e > 1 || amnt_of_dots > 1) {
+            std::string digits(number);
+            digits.erase(
+                std::remove(digits.begin(), digits.end(), '_'), digits.end());
+            error(error_type::lexical_error,
+                add_pointers("~", digits, 0, len),
+                file_name,
+                line,
+                "Invalid number literal!");
+            exit(1);
         }
 
-        else if (c == ",") {
-            tokens.push_back(token(shift(src), TokenType::Comma, line, column));
-        } else if (c + src[1] == "&&") {
-            shift(src);
-            shift(src);
-            tokens.push_back(token("&&", TokenType::Keyword, line, column));
-        } else if (c + src[1] == "||") {
-            shift(src);
-            shift(src);
-            tokens.push_back(token("||", TokenType::Keyword, line, column));
-        } else if (isStringBody(c)) {
-            std::string body = shift(src);
-
-            while (!src.empty() && src[0] != c) {
-                std::string ch = shift(src);
-
-                if (ch == "\\") {
-                    if (src[0] == "n" || src[0] == "t" || src[0] == "r") {
-                        body += "\\" + shift(src);
-                    } else {
-                        body += "\\" + shift(src);
-                    }
-                } else {
-                    body += ch;
-                }
-            }
-
-            body += shift(src);
-
-            tokens.push_back(token(body, TokenType::String, line, column));
-        }
+        return make(end - start, TokenType::Number);
+    }
 
-        else if (isAlpha(c)) {
-            std::string keyword;
+    if (c == '#' && peek(1) == '#') {
+        size_t body = cursor + 2;
 
-            while (!src.empty() && isAlpha(src[0])) {
-                keyword += shift(src);
+        if (body < src.size() && src[body] == '*') {
+            size_t end = src.find("*##", body + 1);
+            if (end == std::string_view::npos) {
+                end = src.size();
             }
 
-            if (keywords.find(keyword) != keywords.end()) {
-                tokens.push_back(
-                    token(keyword, keywords.at(keyword), line, column));
-            } else {
-                tokens.push_back(
-                    token(keyword, TokenType::Identifier, line, column));
-            }
+            advance_to(std::min(end + 3, src.size()));
+            return token(src.substr(body + 1, end - body - 1),
+                TokenType::Comment,
+                start_line,
+                column);
         }
 
-        else if (isNumber(c)) {
-            std::string number;
-            while (!src.empty() && isNumber(src[0])) {
-                number += shift(src);
-            }
-            int len = number.size() - 1;
-
-            if (number[len] == 'e' || number[len] == '.' ||
-                number[len] == '_') {
-                error(error_type::lexical_error,
-                    add_pointers("^", number, len, len),
-                    file_name,
-                    line,
-                    "Invalid number literal!");
-                exit(1);
-            }
-
-            number.erase(
-                std::remove(number.begin(), number.end(), '_'), number.end());
-            int amnt_of_e = std::count(number.begin(), number.end(), 'e');
-            int amnt_of_dots = std::count(number.begin(), number.end(), '.');
-
-            if (amnt_of_e > 1 || amnt_of_dots > 1) {
-                error(error_type::lexical_error,
-                    add_pointers("~", number, 0, len),
-                    file_name,
-                    line,
-                    "Invalid number literal!");
-                exit(1);
-            }
-
-            tokens.push_back(token(number, TokenType::Number, line, column));
-
-        } else if (c + src[1] == "##") {
-            shift(src);
-            shift(src);
+        size_t end = src.find_first_of("\r\n", body);
+        if (end == std::string_view::npos) {
+            end = src.size();
+        }
 
-            if (src[0] == "*") {
-                std::string comment;
-                shift(src);
+        cursor = end;
+        return token(
+            src.substr(body, end - body), TokenType::Comment, start_line, column);
+    }
 
-                while (!src.empty() && (src[0] + src[1] + src[2]) != "*##") {
-                    comment += shift(src);
-                }
+    // every character that can not start a token
+    size_t end = cursor;
+    while (end < src.size() && !is_char(src[end], whitespace_char)) {
+        end++;
+    }
+    std::string invalid_characters(src.substr(start, end - start));
+
+    error(error_type::lexical_error,
+        add_pointers("^", invalid_characters, 0, 0),
+        file_name,
+        line,
+        "Invalid character(s)!");
+    exit(1);
+}
 
-                shift(src);
-                shift(src);
-                shift(src);
+token_stream::token_stream(
+    std::string_view source, const std::string &file_name)
+    : source(source, file_name) {}
 
-                tokens.push_back(
-                    token(comment, TokenType::Comment, line, column));
-            } else {
-                std::string comment;
+const lexer_token &token_stream::peek(size_t offset) {
+    while (count <= offset) {
+        ring[(head + count) % capacity] = source.next();
+        count++;
+    }
 
-                while (!src.empty() && src[0] != "\n" && src[0] != "\r") {
-                    comment += shift(src);
-                }
+    return ring[(head + offset) % capacity];
+}
 
-                tokens.push_back(
-                    token(comment, TokenType::Comment, line, column));
-            }
-        } else {
-            invalid_characters += shift(src);
-            continue;
-        }
-    }
-    tokens.push_back(token("eof", TokenType::EndOfFile, line, column));
-
-    if (invalid_characters.size() > 0) {
-        error(error_type::lexical_error,
-            add_pointers(
-                "^", invalid_characters, 0, invalid_characters.size() - 1),
-            file_name,
-            line,
-            "Invalid character(s)!");
-        exit(1);
-    }
-    return tokens;
-}
\ No newline at end of file
+lexer_token token_stream::next() {
+    lexer_token token = peek();
+    head = (head + 1) % capacity;
+    count--;
+    return token;
+}
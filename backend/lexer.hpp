@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <string>
+#include <string_view>
 
 enum class TokenType
 {
@@ -53,14 +54,52 @@ enum class TokenType
     Any
 };
 
+// value is a view into the source that was tokenized
 struct lexer_token
 {
-    std::string value;
+    std::string_view value;
     TokenType type;
     int line;
     int column;
 };
 
-std::vector<lexer_token> tokenize(const std::string &sourceCode, const std::string &file_name);
+// pulls tokens out of the source one at a time, the source has to outlive
+// the lexer and its tokens. once the source is exhausted every call returns
+// the eof token
+class lexer
+{
+public:
+    lexer(std::string_view source, const std::string &file_name);
+    lexer_token next();
+
+private:
+    std::string_view src;
+    std::string file_name;
+    size_t cursor = 0;
+    size_t line_start = 0;
+    int line = 1;
+
+    void advance_to(size_t end);
+};
+
+// lookahead over a lexer. up to capacity tokens are lexed ahead into a ring
+// buffer and handed out by reference, nothing else of the file is kept
+class token_stream
+{
+public:
+    static constexpr size_t capacity = 4;
+
+    token_stream(std::string_view source, const std::string &file_name);
+
+    // valid until the token is consumed by next
+    const lexer_token &peek(size_t offset = 0);
+    lexer_token next();
+
+private:
+    lexer source;
+    lexer_token ring[capacity];
+    size_t head = 0;
+    size_t count = 0;
+};
 
 #endif
\ No newline at end of file
@@ -2,7 +2,9 @@
 #include "../gemSettings.hpp"
 #include "debugger.hpp"
 #include "magic_enum/magic_enum.hpp"
+#include <algorithm>
 #include <any>
+#include <cstdlib>
 #include <bits/chrono.h>
 #include <deque>
 #include <iostream>
@@ -13,66 +15,56 @@
 #include <variant>
 #include <vector>
 
-std::deque<lexer_token> tokens;
-std::vector<std::string> lines_of_code;
+// only alive while produceAST runs, both borrow from its source
+std::unique_ptr<token_stream> tokens;
+line_index source_lines;
 std::string file_name;
+// the ast being built, handed to the caller at the end of produceAST
+ast tree;
 
-std::string parser::get_line() {
-    std::string line;
-    uint64_t line_count = parser::at().line;
-    uint64_t index = 0;
-    while (tokens[index].line == line_count) {
-        line += tokens[index].value + " ";
-        index++;
-    }
-
-    return line;
-}
-
-astToken parser::produceAST(
-    const std::string &source, const std::string &name) {
-    tokens.clear();
-    lines_of_code.clear();
+ast parser::produceAST(const std::string &source, const std::string &name) {
     file_name = name;
-    std::vector<std::shared_ptr<astToken>> body;
+    std::vector<node_index> body;
     if (settings.verbose)
         std::cout << "Tokenizing file content" << std::endl;
 
-    auto v = tokenize(source, file_name);
-    tokens = std::deque(v.begin(), v.end());
-    int eof_line = tokens.at(tokens.size() - 1).line;
+    tokens = std::make_unique<token_stream>(source, file_name);
 
-    for (size_t line = 1; line < eof_line; ++line) {
-        lines_of_code.push_back(parser::get_line());
-    }
+    // error context, the lines are only looked up when an error is reported
+    source_lines = line_index(source);
 
     if (settings.verbose)
         std::cout << "Tokenizing file content has been finished" << std::endl;
     if (settings.verbose)
         std::cout << "Parsing tokens begin" << std::endl;
 
-    while (tokens[0].type != TokenType::EndOfFile) {
-        if (tokens[0].type == TokenType::Comment) {
+    while (parser::at().type != TokenType::EndOfFile) {
+        if (parser::at().type == TokenType::Comment) {
             parser::eat();
             continue;
         }
-        body.push_back(std::make_shared<astToken>(parser::parseStmt()));
+        body.push_back(parser::parseStmt());
     }
 
+    tokens.reset();
+    source_lines = line_index();
+
     if (settings.verbose)
         std::cout << "Parsing tokens finish" << std::endl;
 
-    return astToken{.kind = tokenKind::Program, .body = body};
+    tree.body = tree.list(body);
+
+    ast program = std::move(tree);
+    tree = ast();
+    return program;
 };
 
-lexer_token parser::at() {
-    return tokens[0];
+const lexer_token &parser::at() {
+    return tokens->peek();
 }
 
 lexer_token parser::eat() {
-    lexer_token value = tokens.front();
-    tokens.pop_front();
-    return value;
+    return tokens->next();
 }
 
 /*lexer_token parser::eat() {
@@ -83,14 +75,15 @@ lexer_token parser::eat() {
 
 lexer_token parser::expect(TokenType type, std::string kindof) {
     if (type == TokenType::Any) {
-        if (tokens.size() == 0 || tokens[0].type == TokenType::EndOfFile) {
-            std::string full_line = lines_of_code[lines_of_code.size() - 1];
+        if (parser::at().type == TokenType::EndOfFile) {
+            size_t last_line = source_lines.line_count();
+            std::string full_line = source_lines.line(last_line);
             std::string message =
                 add_pointers("~", full_line, 0, full_line.size());
             error(error_type::parsing_error,
                 message,
                 file_name,
-                lines_of_code.size() - 1,
+                last_line,
                 "Expected " + kindof + " after statement/expression!");
             exit(1);
         } else {
@@ -99,21 +92,22 @@ lexer_token parser::expect(TokenType type, std::string kindof) {
     };
 
     if (parser::at().type != type) {
-        int line = parser::at().line - 1;
-        std::string full_line;
-
-        if (line > lines_of_code.size() - 1) {
-            full_line = lines_of_code[lines_of_code.size() - 1];
-        } else {
-            full_line = lines_of_code[line];
+        size_t line = parser::at().line;
+        std::string full_line = source_lines.line(line);
+        int column = parser::at().column - 1;
+        int end = column + parser::at().value.size() - 1;
+
+        // the end of the file is marked at the end of the last line
+        if (parser::at().type == TokenType::EndOfFile) {
+            line = source_lines.line_count();
+            column = end = std::max<int>(full_line.size() - 1, 0);
         }
 
-        std::string message = add_pointers(
-            "~", full_line, parser::at().column - 1, parser::at().value.size());
+        std::string message = add_pointers("~", full_line, column, end);
         error(error_type::parsing_error,
             message,
             file_name,
-            parser::at().line,
+            line,
             "Expected " + std::string(magic_enum::enum_name(type)) + ", got " +
                 std::string(magic_enum::enum_name(parser::at().type)) + "!");
         exit(1);
@@ -128,7 +122,7 @@ void parser::skip_semi_colon() {
     }
 }
 
-astToken parser::parseStmt() {
+node_index parser::parseStmt() {
     switch (parser::at().type) {
     case TokenType::Var:
         return parser::parse_var_declaration();
@@ -145,9 +139,9 @@ astToken parser::parseStmt() {
     case TokenType::Keyword: {
         auto token = parser::eat();
         parser::skip_semi_colon();
-        return astToken{.kind = tokenKind::Keyword,
-            .value = token.value,
-            .line = token.line};
+        return tree.add(tokenKind::Keyword,
+            token.line,
+            literal_node{.value = tree.intern(token.value)});
     }
     case TokenType::Reflect:
         return parser::parse_reflect();
@@ -160,70 +154,88 @@ astToken parser::parseStmt() {
     };
 }
 
-astToken parser::parse_expr() {
+node_index parser::parse_expr() {
     return parser::parse_unary_expr();
 }
 
-astToken parser::parse_extern() {
+// the statements of a function, loop or branch, either a block in braces or
+// a single statement
+node_list parser::parse_block() {
+    std::vector<node_index> body;
+
+    if (parser::at().type == TokenType::OpenBrace) {
+        parser::expect(TokenType::OpenBrace);
+
+        while (parser::at().type != TokenType::EndOfFile &&
+               parser::at().type != TokenType::CloseBrace) {
+            body.push_back(parser::parseStmt());
+        }
+        parser::expect(TokenType::CloseBrace);
+    } else {
+        parser::expect(TokenType::Any);
+        body.push_back(parser::parseStmt());
+    }
+
+    return tree.list(body);
+}
+
+node_index parser::parse_extern() {
     int line = parser::at().line;
 
     parser::eat();
 
-    astToken identifier = parser::parse_primary_expr();
+    node_index identifier = parser::parse_primary_expr();
     parser::expect(TokenType::DoubleColon);
-    astToken path = parser::parse_primary_expr();
+    node_index path = parser::parse_primary_expr();
     parser::expect(TokenType::DoubleColon);
 
-    std::vector<std::shared_ptr<astToken>> args = parser::parse_arguments();
-    std::vector<std::string> inputTypes;
+    std::vector<node_index> args = parser::parse_arguments();
+    std::vector<string_index> inputTypes;
 
-    for (std::shared_ptr<astToken> value : args) {
-        inputTypes.push_back(value.get()->value);
+    for (node_index value : args) {
+        inputTypes.push_back(tree.intern(tree.value(value)));
     }
 
     parser::expect(TokenType::Arrow);
 
-    astToken returnType = parser::parse_primary_expr();
+    node_index returnType = parser::parse_primary_expr();
 
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::Extern,
-        .value = returnType.value,
-        .right = std::make_shared<astToken>(path),
-        .left = std::make_shared<astToken>(identifier),
-        .name = identifier.value,
-        .params = inputTypes,
-        .line = line};
+    return tree.add(tokenKind::Extern,
+        line,
+        extern_node{.name = tree.intern(tree.value(identifier)),
+            .path = path,
+            .params = tree.list(inputTypes),
+            .return_type = tree.intern(tree.value(returnType))});
 }
 
-astToken parser::parse_shine() {
+node_index parser::parse_shine() {
     int line = parser::at().line;
 
     parser::eat();
-    astToken stmt = parser::parseStmt();
+    node_index stmt = parser::parseStmt();
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::Export,
-        .left = std::make_shared<astToken>(stmt),
-        .line = line};
+    return tree.add(tokenKind::Export, line, unary_node{.right = stmt});
 }
 
-astToken parser::parse_reflect() {
+node_index parser::parse_reflect() {
     int line = parser::at().line;
 
     parser::eat();
-    astToken path = parser::parse_primary_expr();
+    node_index path = parser::parse_primary_expr();
 
     if (parser::at().type == TokenType::DoubleColon) {
         parser::eat();
         // we parsing those funny things cuz i cant use tables since i cant do
         // {abc} or else it will give a null value cuz identifier stuff
         parser::expect(TokenType::OpenBrace);
-        std::vector<std::string> include;
+        std::vector<string_index> include;
 
         while (parser::at().type != TokenType::EndOfFile &&
                parser::at().type != TokenType::CloseBrace) {
-            include.push_back(parser::eat().value);
+            include.push_back(tree.intern(parser::eat().value));
             if (parser::at().type != TokenType::CloseBrace)
                 parser::expect(TokenType::Comma);
         }
@@ -231,96 +243,75 @@ astToken parser::parse_reflect() {
         parser::expect(TokenType::CloseBrace);
         parser::skip_semi_colon();
 
-        return astToken{.kind = tokenKind::Import,
-            .left = std::make_shared<astToken>(path),
-            .params = include,
-            .line = line};
+        return tree.add(tokenKind::Import,
+            line,
+            import_node{.path = path, .names = tree.list(include)});
     } else {
         parser::skip_semi_colon();
 
-        return astToken{.kind = tokenKind::Import,
-            .left = std::make_shared<astToken>(path),
-            .line = line};
+        return tree.add(tokenKind::Import, line, import_node{.path = path});
     }
 }
 
-astToken parser::parse_return_stmt() {
+node_index parser::parse_return_stmt() {
     int line = parser::at().line;
 
     parser::eat();
     parser::expect(TokenType::Any);
-    auto right = std::make_shared<astToken>(parser::parseStmt());
+    node_index right = parser::parseStmt();
     parser::skip_semi_colon();
-    return astToken{
-        .kind = tokenKind::ReturnStmt, .right = right, .line = line};
+    return tree.add(tokenKind::ReturnStmt, line, unary_node{.right = right});
 }
 
-astToken parser::parse_or_keyword() {
-    astToken left = parser::parse_and_keyword();
+node_index parser::parse_or_keyword() {
+    node_index left = parser::parse_and_keyword();
 
     while (parser::at().value == "||") {
         parser::eat();
-        astToken right = parser::parse_and_keyword();
+        node_index right = parser::parse_and_keyword();
 
-        left = astToken{.kind = tokenKind::LogicGateExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = "or",
-            .line = left.line};
+        left = tree.add(tokenKind::LogicGateExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = tree.intern("or")});
     }
 
     return left;
 }
 
-astToken parser::parse_and_keyword() {
+node_index parser::parse_and_keyword() {
 
-    astToken left = parser::parse_comparasion_expr();
+    node_index left = parser::parse_comparasion_expr();
 
     while (parser::at().value == "&&") {
         parser::eat();
-        astToken right = parser::parse_comparasion_expr();
+        node_index right = parser::parse_comparasion_expr();
 
-        left = astToken{.kind = tokenKind::LogicGateExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = "and",
-            .line = left.line};
+        left = tree.add(tokenKind::LogicGateExpr,
+            tree.line(left),
+            binary_node{
+                .left = left, .right = right, .op = tree.intern("and")});
     }
 
     return left;
 }
 
-astToken parser::parse_while_loop_stmt() {
+node_index parser::parse_while_loop_stmt() {
     int line = parser::at().line;
 
     parser::eat();
     parser::expect(TokenType::Any, "condition");
 
-    astToken condition = parser::parse_expr();
-
-    std::vector<std::shared_ptr<astToken>> body;
-    if (parser::at().type == TokenType::OpenBrace) {
-        parser::expect(TokenType::OpenBrace);
-
-        while (parser::at().type != TokenType::EndOfFile &&
-               parser::at().type != TokenType::CloseBrace) {
-            body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-        }
-        parser::expect(TokenType::CloseBrace);
-    } else {
-        parser::expect(TokenType::Any);
-        body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-    }
+    node_index condition = parser::parse_expr();
+    node_list body = parser::parse_block();
 
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::WhileLoopStmt,
-        .left = std::make_shared<astToken>(condition),
-        .body = body,
-        .line = line};
+    return tree.add(tokenKind::WhileLoopStmt,
+        line,
+        while_node{.condition = condition, .body = body});
 }
 
-astToken parser::parse_for_loop_stmt() {
+node_index parser::parse_for_loop_stmt() {
     int line = parser::at().line;
 
     parser::eat();
@@ -332,197 +323,142 @@ astToken parser::parse_for_loop_stmt() {
     */
     parser::expect(TokenType::Any, "arguments");
 
-    std::vector<std::shared_ptr<astToken>> argumentsAST =
-        parser::parse_arguments();
-    std::vector<std::string> arguments;
+    std::vector<node_index> argumentsAST = parser::parse_arguments();
+    std::vector<string_index> arguments;
 
-    for (std::shared_ptr<astToken> &arg : argumentsAST) {
-        arguments.push_back((*arg).value);
+    for (node_index arg : argumentsAST) {
+        arguments.push_back(tree.intern(tree.value(arg)));
     }
 
     parser::expect(TokenType::In);
 
-    std::variant<std::shared_ptr<astToken>,
-        std::vector<std::shared_ptr<astToken>>>
-        expr;
+    for_node loop{.params = tree.list(arguments)};
     parser::expect(TokenType::Any, "iterator");
 
-    if (parser::at().type == TokenType::OpenParen) {
-        expr = parser::parse_arguments();
-    } else {
-        expr = std::make_shared<astToken>(parser::parse_expr());
+    if (parser::at().type != TokenType::OpenParen) {
+        error(error_type::parsing_error,
+            "",
+            file_name,
+            line,
+            "Iterator for loops are not supported yet!");
+        exit(1);
     }
+    loop.range = tree.list(parser::parse_arguments());
 
-    std::vector<std::shared_ptr<astToken>> body;
-    if (parser::at().type == TokenType::OpenBrace) {
-        parser::expect(TokenType::OpenBrace);
-
-        while (parser::at().type != TokenType::EndOfFile &&
-               parser::at().type != TokenType::CloseBrace) {
-            body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-        }
-        parser::expect(TokenType::CloseBrace);
-    } else {
-        parser::expect(TokenType::Any);
-        body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-    }
+    loop.body = parser::parse_block();
 
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::ForLoopStmt,
-        .body = body,
-        .params = arguments,
-        .iterator = expr,
-        .line = line};
+    return tree.add(tokenKind::ForLoopStmt, line, loop);
 }
 
-astToken parser::parse_if_stmt(bool isELIFChain) {
+node_index parser::parse_if_stmt(bool isELIFChain) {
     int line = parser::at().line;
     parser::eat();
     parser::expect(TokenType::Any, "condition");
-    astToken condition = parser::parse_expr();
+    node_index condition = parser::parse_expr();
 
-    std::vector<std::shared_ptr<astToken>> body;
-    if (parser::at().type == TokenType::OpenBrace) {
-        parser::expect(TokenType::OpenBrace);
-
-        while (parser::at().type != TokenType::EndOfFile &&
-               parser::at().type != TokenType::CloseBrace) {
-            body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-        }
-        parser::expect(TokenType::CloseBrace);
-    } else {
-        parser::expect(TokenType::Any);
-        body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-    }
-
-    std::vector<std::shared_ptr<astToken>> elifChain;
-    std::vector<std::shared_ptr<astToken>> elsebody;
+    if_node branch{.condition = condition, .body = parser::parse_block()};
 
     if (isELIFChain == false) {
+        std::vector<node_index> elifChain;
+
         if (parser::at().value == "elif") {
             while (parser::at().value == "elif") {
-                elifChain.push_back(
-                    std::make_shared<astToken>(parser::parse_if_stmt(true)));
+                elifChain.push_back(parser::parse_if_stmt(true));
             }
         }
+        branch.elifs = tree.list(elifChain);
+
         if (parser::at().value == "else") {
             parser::eat();
-            if (parser::at().type == TokenType::OpenBrace) {
-                parser::expect(TokenType::OpenBrace);
-
-                while (parser::at().type != TokenType::EndOfFile &&
-                       parser::at().type != TokenType::CloseBrace) {
-                    elsebody.push_back(
-                        std::make_shared<astToken>(parser::parseStmt()));
-                }
-                parser::expect(TokenType::CloseBrace);
+            bool braced = parser::at().type == TokenType::OpenBrace;
+
+            branch.else_body = parser::parse_block();
+            if (braced) {
                 parser::skip_semi_colon();
-            } else {
-                parser::expect(TokenType::Any);
-                elsebody.push_back(
-                    std::make_shared<astToken>(parser::parseStmt()));
             }
         } else {
             parser::skip_semi_colon();
         }
     }
 
-    return astToken{.kind = tokenKind::IfStmt,
-        .left = std::make_shared<astToken>(condition),
-        .elifChain = elifChain,
-        .elseBody = elsebody,
-        .body = body,
-        .line = line};
+    return tree.add(tokenKind::IfStmt, line, branch);
 }
 
-astToken parser::parse_function_declaration() {
+node_index parser::parse_function_declaration() {
     int line = parser::at().line;
     parser::eat();
-    std::string identifier =
-        (parser::at().type == TokenType::Identifier) ? parser::eat().value : "";
+    std::string_view identifier(
+        (parser::at().type == TokenType::Identifier) ? parser::eat().value : "");
 
-    std::vector<std::shared_ptr<astToken>> args = parser::parse_arguments();
-    std::vector<std::string> params;
+    std::vector<node_index> args = parser::parse_arguments();
+    std::vector<string_index> params;
 
-    for (std::shared_ptr<astToken> value : args) {
-        params.push_back(value.get()->value);
+    for (node_index value : args) {
+        params.push_back(tree.intern(tree.value(value)));
     }
 
-    std::vector<std::shared_ptr<astToken>> body;
-    if (parser::at().type == TokenType::OpenBrace) {
-        parser::expect(TokenType::OpenBrace);
+    function_node function{.name = tree.intern(identifier),
+        .params = tree.list(params)};
+    function.body = parser::parse_block();
 
-        while (parser::at().type != TokenType::EndOfFile &&
-               parser::at().type != TokenType::CloseBrace) {
-            body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-        }
-        parser::expect(TokenType::CloseBrace);
-    } else {
-        parser::expect(TokenType::Any);
-        body.push_back(std::make_shared<astToken>(parser::parseStmt()));
-    }
-
-    return astToken{.kind = tokenKind::FunctionDeclaration,
-        .body = body,
-        .name = identifier,
-        .params = params,
-        .line = line};
+    return tree.add(tokenKind::FunctionDeclaration, line, function);
 }
 
-astToken parser::parse_var_declaration() {
+node_index parser::parse_var_declaration() {
     int line = parser::at().line;
     parser::eat();
-    std::string identifier = parser::expect(TokenType::Identifier).value;
+    string_index identifier =
+        tree.intern(parser::expect(TokenType::Identifier).value);
 
     if (parser::at().type == TokenType::Equals) {
         parser::eat();
         parser::expect(TokenType::Any, "value");
-        std::shared_ptr<astToken> value =
-            std::make_shared<astToken>(parser::parseStmt());
+        node_index value = parser::parseStmt();
 
         parser::skip_semi_colon();
 
-        return astToken{.kind = tokenKind::VariableDeclaration,
-            .right = value,
-            .name = identifier,
-            .line = line};
+        return tree.add(tokenKind::VariableDeclaration,
+            line,
+            variable_node{.name = identifier, .value = value});
     };
 
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::VariableDeclaration,
-        .right = std::make_shared<astToken>(
-            astToken{.kind = tokenKind::NumberLiteral, .value = "0"}),
-        .name = identifier,
-        .line = line};
+    node_index zero = tree.add(tokenKind::NumberLiteral,
+        0,
+        literal_node{.value = tree.intern("0"), .number = 0});
+    return tree.add(tokenKind::VariableDeclaration,
+        line,
+        variable_node{.name = identifier, .value = zero});
 }
 
-astToken parser::parse_assignment_expr() {
-    astToken left = parser::parse_or_keyword();
+node_index parser::parse_assignment_expr() {
+    node_index left = parser::parse_or_keyword();
 
     if (parser::at().type == TokenType::Equals) {
-        std::string op = parser::eat().value;
-        astToken right;
+        std::string op(parser::eat().value);
+        node_index right;
         parser::expect(TokenType::Any, "value");
 
         if (op[0] == '+' || op[0] == '-' || op[0] == '*' || op[0] == '/' ||
             op[0] == '^' || op[0] == '%') {
-            right = astToken{.kind = tokenKind::BinaryExpr,
-                .right = std::make_shared<astToken>(parser::parse_or_keyword()),
-                .left = std::make_shared<astToken>(left),
-                .op = std::string(1, op[0]),
-                .line = left.line};
+            node_index value = parser::parse_or_keyword();
+            right = tree.add(tokenKind::BinaryExpr,
+                tree.line(left),
+                binary_node{.left = left,
+                    .right = value,
+                    .op = tree.intern(op.substr(0, 1))});
         } else {
             right = parser::parse_or_keyword();
         }
 
         parser::skip_semi_colon();
 
-        return astToken{.kind = tokenKind::AssignmentExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .line = left.line};
+        return tree.add(tokenKind::AssignmentExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right});
     }
 
     return left;
@@ -544,121 +480,108 @@ astToken parser::parse_assignment_expr() {
         return this.parse_primary_expr()
     end
 */
-astToken parser::parse_unary_expr() {
+node_index parser::parse_unary_expr() {
     if (parser::at().value == "-" || parser::at().value == "!") {
-        std::string op = parser::eat().value;
+        string_index op = tree.intern(parser::eat().value);
         parser::expect(TokenType::Any, "value");
-        astToken value = parser::parse_assignment_expr();
+        node_index value = parser::parse_assignment_expr();
 
-        return astToken{.kind = tokenKind::UnaryExpr,
-            .right = std::make_shared<astToken>(value),
-            .op = op,
-            .line = value.line};
+        return tree.add(tokenKind::UnaryExpr,
+            tree.line(value),
+            unary_node{.right = value, .op = op});
     }
 
     return parser::parse_assignment_expr();
 }
 
-astToken parser::parse_comparasion_expr() {
-    astToken left = parser::parse_object_expr();
+node_index parser::parse_comparasion_expr() {
+    node_index left = parser::parse_object_expr();
 
     while (parser::at().value == ">" || parser::at().value == "<" ||
            parser::at().value == ">=" || parser::at().value == "<=" ||
            parser::at().value == "==" || parser::at().value == "!=") {
-        std::string op = parser::eat().value;
+        string_index op = tree.intern(parser::eat().value);
         parser::expect(TokenType::Any, "value");
-        astToken right = parser::parse_object_expr();
+        node_index right = parser::parse_object_expr();
 
-        left = astToken{.kind = tokenKind::ComparisonExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::ComparisonExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
 }
 
-astToken parser::parse_power_expr() {
-    astToken left = parser::parse_member_call_expr();
+node_index parser::parse_power_expr() {
+    node_index left = parser::parse_member_call_expr();
 
     while (parser::at().value == "^" || parser::at().value == "%") {
-        std::string op = parser::eat().value;
-        astToken right = parser::parse_member_call_expr();
+        string_index op = tree.intern(parser::eat().value);
+        node_index right = parser::parse_member_call_expr();
 
-        left = astToken{.kind = tokenKind::BinaryExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::BinaryExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
 }
 
-astToken parser::parse_division_expr() {
-    astToken left = parser::parse_power_expr();
+node_index parser::parse_division_expr() {
+    node_index left = parser::parse_power_expr();
 
     while (parser::at().value == "/") {
-        std::string op = parser::eat().value;
-        astToken right = parser::parse_power_expr();
+        string_index op = tree.intern(parser::eat().value);
+        node_index right = parser::parse_power_expr();
 
-        left = astToken{.kind = tokenKind::BinaryExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::BinaryExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
 }
 
-astToken parser::parse_multiplicative_expr() {
-    astToken left = parser::parse_division_expr();
+node_index parser::parse_multiplicative_expr() {
+    node_index left = parser::parse_division_expr();
 
     while (parser::at().value == "*") {
-        std::string op = parser::eat().value;
-        astToken right = parser::parse_division_expr();
+        string_index op = tree.intern(parser::eat().value);
+        node_index right = parser::parse_division_expr();
 
-        left = astToken{.kind = tokenKind::BinaryExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::BinaryExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
 }
 
-astToken parser::parse_subtraction_expr() {
-    astToken left = parser::parse_multiplicative_expr();
+node_index parser::parse_subtraction_expr() {
+    node_index left = parser::parse_multiplicative_expr();
 
     while (parser::at().value == "-") {
-        std::string op = parser::eat().value;
-        astToken right = parser::parse_multiplicative_expr();
+        string_index op = tree.intern(parser::eat().value);
+        node_index right = parser::parse_multiplicative_expr();
 
-        left = astToken{.kind = tokenKind::BinaryExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::BinaryExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
 }
 
-astToken parser::parse_additive_expr() {
-    astToken left = parser::parse_subtraction_expr();
+node_index parser::parse_additive_expr() {
+    node_index left = parser::parse_subtraction_expr();
 
     while (parser::at().value == "+") {
-        std::string op = parser::eat().value;
-        astToken right = parser::parse_subtraction_expr();
+        string_index op = tree.intern(parser::eat().value);
+        node_index right = parser::parse_subtraction_expr();
 
-        left = astToken{.kind = tokenKind::BinaryExpr,
-            .right = std::make_shared<astToken>(right),
-            .left = std::make_shared<astToken>(left),
-            .op = op,
-            .line = left.line};
+        left = tree.add(tokenKind::BinaryExpr,
+            tree.line(left),
+            binary_node{.left = left, .right = right, .op = op});
     }
 
     return left;
@@ -686,24 +609,23 @@ this.parse_arguments_list()
     end
 */
 
-std::vector<std::shared_ptr<astToken>> parser::parse_arguments_list() {
-    std::vector<std::shared_ptr<astToken>> args;
-    args.push_back(std::make_shared<astToken>(parser::parseStmt()));
+std::vector<node_index> parser::parse_arguments_list() {
+    std::vector<node_index> args;
+    args.push_back(parser::parseStmt());
 
     while (parser::at().type == TokenType::Comma) {
         parser::eat();
-        args.push_back(std::make_shared<astToken>(parser::parseStmt()));
+        args.push_back(parser::parseStmt());
     }
 
     return args;
 }
 
-std::vector<std::shared_ptr<astToken>> parser::parse_arguments() {
+std::vector<node_index> parser::parse_arguments() {
     parser::expect(TokenType::OpenParen);
-    std::vector<std::shared_ptr<astToken>> args =
-        parser::at().type == TokenType::CloseParen
-            ? std::vector<std::shared_ptr<astToken>>{}
-            : parser::parse_arguments_list();
+    std::vector<node_index> args = parser::at().type == TokenType::CloseParen
+                                       ? std::vector<node_index>{}
+                                       : parser::parse_arguments_list();
 
     parser::expect(TokenType::CloseParen);
 
@@ -740,12 +662,11 @@ std::vector<std::shared_ptr<astToken>> parser::parse_arguments() {
     end
 */
 
-astToken parser::parse_call_expr(std::shared_ptr<astToken> caller) {
+node_index parser::parse_call_expr(node_index caller) {
     int line = parser::at().line;
-    astToken call_expr{.kind = tokenKind::CallExpr,
-        .args = parser::parse_arguments(),
-        .caller = caller,
-        .line = line};
+    node_list args = tree.list(parser::parse_arguments());
+    node_index call_expr = tree.add(
+        tokenKind::CallExpr, line, call_node{.caller = caller, .args = args});
 
     if (parser::at().type == TokenType::OpenParen) {
         call_expr = parser::parse_call_expr(caller);
@@ -755,54 +676,54 @@ astToken parser::parse_call_expr(std::shared_ptr<astToken> caller) {
     return call_expr;
 }
 
-astToken parser::parse_member_call_expr() {
-    astToken member = parser::parse_member_expr();
+node_index parser::parse_member_call_expr() {
+    node_index member = parser::parse_member_expr();
 
     if (parser::at().type == TokenType::OpenParen) {
-        return parser::parse_call_expr(std::make_shared<astToken>(member));
+        return parser::parse_call_expr(member);
     }
 
     return member;
 }
 
-astToken parser::parse_object_expr() {
+node_index parser::parse_object_expr() {
     if (parser::at().type != TokenType::OpenBrace) {
         return parser::parse_additive_expr();
     }
     int line = parser::at().line;
     parser::eat();
 
-    std::vector<map_property> properties;
+    // key and value of every property in turn
+    std::vector<node_index> properties;
+
+    // properties without a key get the next array index
+    auto positional = [&](node_index value) {
+        size_t index = properties.size() / 2;
+        properties.push_back(tree.add(tokenKind::NumberLiteral,
+            0,
+            literal_node{.value = tree.intern(std::to_string(index)),
+                .number = double(index)}));
+        properties.push_back(value);
+    };
 
     while (parser::at().type != TokenType::EndOfFile &&
            parser::at().type != TokenType::CloseBrace) {
-        std::shared_ptr<astToken> key =
-            std::make_shared<astToken>(parser::parseStmt());
+        node_index key = parser::parseStmt();
 
         if (parser::at().type == TokenType::Comma) {
             parser::eat();
-            map_property token{.key = std::make_shared<astToken>(astToken{
-                                   .kind = tokenKind::NumberLiteral,
-                                   .value = std::to_string(properties.size())}),
-                .value = key};
-            properties.push_back(token);
+            positional(key);
             continue;
         } else if (parser::at().type == TokenType::CloseBrace) {
-            map_property token{.key = std::make_shared<astToken>(astToken{
-                                   .kind = tokenKind::NumberLiteral,
-                                   .value = std::to_string(properties.size())}),
-                .value = key};
-            properties.push_back(token);
+            positional(key);
             continue;
         };
 
         parser::expect(TokenType::Colon);
 
-        std::shared_ptr<astToken> value =
-            std::make_shared<astToken>(parser::parseStmt());
-        map_property token{.key = key, .value = value};
-
-        properties.push_back(token);
+        node_index value = parser::parseStmt();
+        properties.push_back(key);
+        properties.push_back(value);
 
         if (parser::at().type != TokenType::CloseBrace) {
             parser::expect(TokenType::Comma);
@@ -812,21 +733,21 @@ astToken parser::parse_object_expr() {
     parser::expect(TokenType::CloseBrace);
     parser::skip_semi_colon();
 
-    return astToken{.kind = tokenKind::ObjectLiteral,
-        .properties = properties,
-        .line = line};
+    return tree.add(tokenKind::ObjectLiteral,
+        line,
+        object_node{.properties = tree.list(properties)});
 }
 
-astToken parser::parse_member_expr() {
+node_index parser::parse_member_expr() {
     int line = parser::at().line;
-    astToken object = parser::parse_primary_expr();
+    node_index object = parser::parse_primary_expr();
 
     while (parser::at().type == TokenType::Dot ||
            parser::at().type == TokenType::OpenBracket) {
         TokenType op = parser::eat().type;
 
         bool computed;
-        astToken property;
+        node_index property;
 
         if (op == TokenType::Dot) {
             computed = false;
@@ -838,13 +759,10 @@ astToken parser::parse_member_expr() {
             parser::expect(TokenType::CloseBracket);
         }
 
-        astToken newObject{.kind = tokenKind::MemberExpr,
-            .object = std::make_shared<astToken>(object),
-            .property = std::make_shared<astToken>(property),
-            .computed = computed,
-            .line = line};
-
-        object = newObject;
+        object = tree.add(tokenKind::MemberExpr,
+            line,
+            member_node{
+                .object = object, .property = property, .computed = computed});
     }
 
     return object;
@@ -862,47 +780,54 @@ std::string replaceNewlines(const std::string &input) {
 
     return s;
 }
-astToken parser::parse_primary_expr() {
+node_index parser::parse_primary_expr() {
     TokenType type = parser::at().type;
     switch (type) {
     case TokenType::Identifier: {
         auto token = parser::eat();
 
-        return astToken{.kind = tokenKind::Identifier,
-            .value = token.value,
-            .line = token.line};
+        return tree.add(tokenKind::Identifier,
+            token.line,
+            identifier_node{.name = tree.intern(token.value)});
     }
     case TokenType::Number: {
         auto token = parser::eat();
 
-        return astToken{.kind = tokenKind::NumberLiteral,
-            .value = token.value,
-            .line = token.line};
+        // the lexer keeps the underscore separators
+        std::string number(token.value);
+        number.erase(
+            std::remove(number.begin(), number.end(), '_'), number.end());
+
+        return tree.add(tokenKind::NumberLiteral,
+            token.line,
+            literal_node{.value = tree.intern(number),
+                .number = std::strtod(number.c_str(), nullptr)});
     }
     case TokenType::String: {
         auto token = parser::eat();
 
-        return astToken{.kind = tokenKind::StringLiteral,
-            .value = replaceNewlines(token.value),
-            .line = token.line};
+        return tree.add(tokenKind::StringLiteral,
+            token.line,
+            literal_node{
+                .value = tree.intern(replaceNewlines(std::string(token.value)))});
     }
     case TokenType::Boolean: {
         auto token = parser::eat();
-        return astToken{.kind = tokenKind::BooleanLiteral,
-            .value = token.value,
-            .line = token.line};
+        return tree.add(tokenKind::BooleanLiteral,
+            token.line,
+            literal_node{.value = tree.intern(token.value)});
     }
     case TokenType::OpenParen: {
         parser::eat();
-        astToken value = parser::parseStmt();
+        node_index value = parser::parseStmt();
         parser::expect(TokenType::CloseParen);
         return value;
     };
     default: {
         auto token = parser::eat();
-        return astToken{.kind = tokenKind::Identifier,
-            .value = token.value,
-            .line = token.line};
+        return tree.add(tokenKind::Identifier,
+            token.line,
+            identifier_node{.name = tree.intern(token.value)});
     };
     }
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include "ast.hpp"
 #include "lexer.hpp"
 #include <memory>
 #include <vector>
@@ -10,102 +11,45 @@
 #include <optional>
 #include <map>
 
-enum class tokenKind
-{   
-    Unknown,
-    Program,
-    Identifier,
-    VariableDeclaration,
-    FunctionDeclaration,
-    IfStmt,
-    ForLoopStmt,
-    WhileLoopStmt,
-    ReturnStmt,
-    CallExpr,
-    AssignmentExpr,
-    MemberExpr,
-    ObjectLiteral,
-    NumberLiteral,
-    StringLiteral,
-    BooleanLiteral,
-    BinaryExpr,
-    ComparisonExpr,
-    UnaryExpr,
-    LogicGateExpr,
-    Keyword,
-    Import,
-    Export,
-    Extern,
-};
-
 std::string generateRandomString(size_t length);
-// ik this struct is big and uses a lot of memory but too late to change 80% of the code now
-struct astToken;
-
-struct map_property {
-    std::shared_ptr<astToken> key;
-    std::shared_ptr<astToken> value;
-};
-
-struct astToken
-{
-    tokenKind kind = tokenKind::Unknown;
-    std::string value;
-    std::shared_ptr<astToken> right;
-    std::shared_ptr<astToken> left;
-    std::vector<std::shared_ptr<astToken>> elifChain;
-    std::vector<std::shared_ptr<astToken>> elseBody;
-    std::vector<std::shared_ptr<astToken>> body;
-    std::string name;
-    std::string op;
-    std::vector<std::shared_ptr<astToken>> args;
-    std::shared_ptr<astToken> caller;
-    std::vector<std::string> params;
-    std::vector<map_property> properties;
-    std::shared_ptr<astToken> object;
-    std::shared_ptr<astToken> property;
-    std::variant<std::shared_ptr<astToken>, std::vector<std::shared_ptr<astToken>>> iterator;
-    bool computed;
-    int line=0;
-};
 
 class parser
 {
 public:
-    astToken produceAST(const std::string &source, const std::string &file_name="main.gem");
-    std::string get_line();
-    astToken parse_primary_expr();
-    astToken parse_var_declaration();
-    astToken parse_object_expr();
-    astToken parseStmt();
-    lexer_token at();
+    ast produceAST(const std::string &source, const std::string &file_name="main.gem");
+    node_index parse_primary_expr();
+    node_index parse_var_declaration();
+    node_index parse_object_expr();
+    node_index parseStmt();
+    const lexer_token &at();
     lexer_token eat();
     lexer_token expect(TokenType type, std::string kindof = "expression");
-    astToken parse_expr();
+    node_index parse_expr();
     void skip_semi_colon();
-    astToken parse_additive_expr();
-    astToken parse_subtraction_expr();
-    astToken parse_multiplicative_expr();
-    astToken parse_division_expr();
-    astToken parse_power_expr();
-    astToken parse_function_declaration();
-    astToken parse_call_expr(std::shared_ptr<astToken> caller);
-    astToken parse_member_call_expr();
-    astToken parse_member_expr();
-    astToken parse_assignment_expr();
-    std::vector<std::shared_ptr<astToken>> parse_arguments_list();
-    std::vector<std::shared_ptr<astToken>> parse_arguments();
-    astToken parse_for_loop_stmt();
-    astToken parse_while_loop_stmt();
-    astToken parse_if_stmt(bool isELIFChain = false);
-    astToken parse_return_stmt();
-    astToken parse_and_keyword();
-    astToken parse_or_keyword();
-    astToken parse_comparasion_expr();
-    astToken parse_unary_expr();
-    astToken parse_reflect();
-    astToken parse_shine();
-    astToken parse_extern();
+    node_index parse_additive_expr();
+    node_index parse_subtraction_expr();
+    node_index parse_multiplicative_expr();
+    node_index parse_division_expr();
+    node_index parse_power_expr();
+    node_index parse_function_declaration();
+    node_list parse_block();
+    node_index parse_call_expr(node_index caller);
+    node_index parse_member_call_expr();
+    node_index parse_member_expr();
+    node_index parse_assignment_expr();
+    std::vector<node_index> parse_arguments_list();
+    std::vector<node_index> parse_arguments();
+    node_index parse_for_loop_stmt();
+    node_index parse_while_loop_stmt();
+    node_index parse_if_stmt(bool isELIFChain = false);
+    node_index parse_return_stmt();
+    node_index parse_and_keyword();
+    node_index parse_or_keyword();
+    node_index parse_comparasion_expr();
+    node_index parse_unary_expr();
+    node_index parse_reflect();
+    node_index parse_shine();
+    node_index parse_extern();
 };
 
 #endif
\ No newline at end of file
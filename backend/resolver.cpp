@@ -0,0 +1,333 @@
+#include "resolver.hpp"
+#include <algorithm>
+
+const function_prototype *resolver::resolve(ast &program, scope *globals) {
+    global_scope = globals;
+    tree = &program;
+
+    functions.push_back(resolver_function{});
+    body(program.body);
+
+    gem_prototypes.push_back(function_prototype{.body = program.body,
+        .param_count = 0,
+        .slot_count = functions.back().slot_count});
+    functions.pop_back();
+
+    global_scope = nullptr;
+    tree = nullptr;
+
+    return &gem_prototypes.back();
+}
+
+void resolver::begin_scope() {
+    resolver_function &function = functions.back();
+    function.scopes.push_back(resolver_scope{.first_slot = function.size});
+}
+
+void resolver::end_scope(int &first_slot, int &slot_count) {
+    resolver_function &function = functions.back();
+    first_slot = function.scopes.back().first_slot;
+    slot_count = function.size - first_slot;
+
+    function.size = first_slot;
+    function.scopes.pop_back();
+}
+
+int resolver::declare(const std::string &name) {
+    resolver_function &function = functions.back();
+    resolver_scope &current = function.scopes.back();
+
+    auto found = current.slots.find(name);
+    if (found != current.slots.end()) {
+        return found->second;
+    }
+
+    current.slots[name] = function.size;
+    function.slot_count = std::max(function.slot_count, function.size + 1);
+    return function.size++;
+}
+
+// declarations of the scope are given their slots before anything in it is
+// resolved, ifs do not open a scope so their bodies are hoisted as well
+void resolver::hoist(node_list body) {
+    for (node_index node : tree->items(body)) {
+        switch (tree->kind(node)) {
+        case tokenKind::VariableDeclaration:
+            declare(tree->text(tree->get<variable_node>(node).name));
+            break;
+        case tokenKind::FunctionDeclaration: {
+            string_index name = tree->get<function_node>(node).name;
+            if (name != empty_string) {
+                declare(tree->text(name));
+            }
+            break;
+        }
+        case tokenKind::IfStmt: {
+            if_node &branch = tree->get<if_node>(node);
+            hoist(branch.body);
+            for (node_index elif : tree->items(branch.elifs)) {
+                hoist(tree->get<if_node>(elif).body);
+            }
+            hoist(branch.else_body);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+}
+
+void resolver::bind(variable_kind &binding, int &slot, string_index name) {
+    const std::string &text = tree->text(name);
+
+    slot = find_local(functions.back(), text);
+    if (slot >= 0) {
+        binding = variable_kind::local;
+        return;
+    }
+
+    slot = resolve_upvalue(functions.size() - 1, text);
+    if (slot >= 0) {
+        binding = variable_kind::upvalue;
+        return;
+    }
+
+    binding = variable_kind::global;
+    slot = global_index(text);
+}
+
+int resolver::find_local(resolver_function &function, const std::string &name) {
+    for (int index = function.scopes.size() - 1; index >= 0; --index) {
+        auto found = function.scopes[index].slots.find(name);
+
+        if (found != function.scopes[index].slots.end()) {
+            return found->second;
+        }
+    }
+
+    return -1;
+}
+
+// every function between the declaration and the access gets an upvalue
+// for the variable, the top level code has none
+int resolver::resolve_upvalue(size_t function, const std::string &name) {
+    if (function == 0) {
+        return -1;
+    }
+
+    int local = find_local(functions[function - 1], name);
+    if (local >= 0) {
+        return add_upvalue(functions[function], true, local);
+    }
+
+    int upvalue = resolve_upvalue(function - 1, name);
+    if (upvalue >= 0) {
+        return add_upvalue(functions[function], false, upvalue);
+    }
+
+    return -1;
+}
+
+int resolver::add_upvalue(
+    resolver_function &function, bool in_stack, int index) {
+    for (size_t at = 0; at < function.upvalues.size(); ++at) {
+        upvalue_info &upvalue = function.upvalues[at];
+        if (upvalue.in_stack == in_stack && upvalue.index == index) {
+            return at;
+        }
+    }
+
+    function.upvalues.push_back(
+        upvalue_info{.in_stack = in_stack, .index = uint16_t(index)});
+    return function.upvalues.size() - 1;
+}
+
+// globals are resolved to their slot in the root scope, the map nodes never
+// move so the interpreter can load them with a single indirection
+int resolver::global_index(const std::string &name) {
+    auto found = global_indices.find(name);
+    if (found != global_indices.end()) {
+        return found->second;
+    }
+
+    auto slot = global_scope->stack.try_emplace(name, gem_value::empty());
+    int index = global_scope->global_slots.size();
+    global_scope->global_slots.push_back(&slot.first->second);
+    global_indices[name] = index;
+
+    return index;
+}
+
+int resolver::constant(const std::string &string) {
+    auto found = constant_indices.find(string);
+    if (found != constant_indices.end()) {
+        return found->second;
+    }
+
+    int index = gem_constants.size();
+    gem_constants.push_back(make_string(string));
+    constant_indices[string] = index;
+
+    return index;
+}
+
+void resolver::body(node_list nodes) {
+    for (node_index node : tree->items(nodes)) {
+        statement(node);
+    }
+}
+
+void resolver::statement(node_index node) {
+    switch (tree->kind(node)) {
+    case tokenKind::Identifier: {
+        identifier_node &identifier = tree->get<identifier_node>(node);
+        bind(identifier.binding, identifier.slot, identifier.name);
+        break;
+    }
+    case tokenKind::StringLiteral: {
+        literal_node &literal = tree->get<literal_node>(node);
+        literal.slot = constant(tree->text(literal.value));
+        break;
+    }
+    case tokenKind::VariableDeclaration: {
+        variable_node &variable = tree->get<variable_node>(node);
+        statement(variable.value);
+        bind(variable.binding, variable.slot, variable.name);
+        break;
+    }
+    case tokenKind::FunctionDeclaration:
+        function_declaration(tree->get<function_node>(node));
+        break;
+    case tokenKind::ForLoopStmt:
+        for_loop(tree->get<for_node>(node));
+        break;
+    case tokenKind::WhileLoopStmt:
+        while_loop(tree->get<while_node>(node));
+        break;
+    case tokenKind::IfStmt: {
+        if_node &branch = tree->get<if_node>(node);
+        statement(branch.condition);
+        body(branch.body);
+        for (node_index elif : tree->items(branch.elifs)) {
+            statement(elif);
+        }
+        body(branch.else_body);
+        break;
+    }
+    case tokenKind::ReturnStmt: {
+        node_index right = tree->get<unary_node>(node).right;
+        if (right != no_node) {
+            statement(right);
+        }
+        break;
+    }
+    case tokenKind::AssignmentExpr: {
+        binary_node &assignment = tree->get<binary_node>(node);
+        if (tree->kind(assignment.left) == tokenKind::Identifier) {
+            identifier_node &left =
+                tree->get<identifier_node>(assignment.left);
+            bind(left.binding, left.slot, left.name);
+        } else {
+            statement(assignment.left);
+        }
+        statement(assignment.right);
+        break;
+    }
+    case tokenKind::CallExpr: {
+        call_node &call = tree->get<call_node>(node);
+        statement(call.caller);
+        body(call.args);
+        break;
+    }
+    case tokenKind::MemberExpr: {
+        member_node &member = tree->get<member_node>(node);
+        statement(member.object);
+        if (member.computed) {
+            statement(member.property);
+        } else {
+            member.key = constant(tree->value(member.property));
+            member.slot = gem_member_caches.size();
+            gem_member_caches.emplace_back();
+        }
+        break;
+    }
+    case tokenKind::ObjectLiteral: {
+        auto properties =
+            tree->items(tree->get<object_node>(node).properties);
+        for (size_t index = 0; index < properties.size(); index += 2) {
+            node_index key = properties[index];
+            if (tree->kind(key) != tokenKind::Identifier) {
+                statement(key);
+            } else {
+                identifier_node &identifier = tree->get<identifier_node>(key);
+                identifier.slot = constant(tree->text(identifier.name));
+            }
+            statement(properties[index + 1]);
+        }
+        break;
+    }
+    case tokenKind::BinaryExpr:
+    case tokenKind::ComparisonExpr:
+    case tokenKind::LogicGateExpr: {
+        binary_node &binary = tree->get<binary_node>(node);
+        statement(binary.left);
+        statement(binary.right);
+        break;
+    }
+    case tokenKind::UnaryExpr:
+        statement(tree->get<unary_node>(node).right);
+        break;
+    default:
+        break;
+    }
+}
+
+void resolver::function_declaration(function_node &node) {
+    if (node.name != empty_string) {
+        bind(node.binding, node.slot, node.name);
+    }
+
+    functions.push_back(resolver_function{});
+    begin_scope();
+
+    // params always take the first slots of the frame
+    for (string_index param : tree->items(node.params)) {
+        declare(tree->text(param));
+    }
+
+    hoist(node.body);
+    body(node.body);
+
+    int first_slot, slot_count;
+    end_scope(first_slot, slot_count);
+
+    node.prototype = gem_prototypes.size();
+    gem_prototypes.push_back(function_prototype{.body = node.body,
+        .param_count = int(node.params.size),
+        .slot_count = functions.back().slot_count,
+        .upvalues = std::move(functions.back().upvalues)});
+    functions.pop_back();
+}
+
+void resolver::for_loop(for_node &node) {
+    begin_scope();
+
+    if (node.params.size > 0) {
+        node.slot = declare(tree->text(tree->items(node.params)[0]));
+    }
+
+    hoist(node.body);
+
+    body(node.range);
+
+    body(node.body);
+    end_scope(node.first_slot, node.slot_count);
+}
+
+void resolver::while_loop(while_node &node) {
+    begin_scope();
+    hoist(node.body);
+    statement(node.condition);
+    body(node.body);
+    end_scope(node.first_slot, node.slot_count);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "interpreter.hpp"
+#include "parser.hpp"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// walks the ast once before the tree-walker runs and tells every variable
+// access where its variable lives. globals get a slot in scope::global_slots
+// of the root scope, locals a slot in the frame of the function they are
+// declared in and variables of enclosing functions an upvalue, like the
+// bytecode compiler does. only the variables that closures capture ever
+// leave their frame.
+//
+// function bodies, while loops and for loops open a scope, the slots of a
+// loop follow the ones of its enclosing scope and are reused once it ends.
+// declarations are hoisted to the top of their scope so closures can see
+// locals declared after them.
+//
+// string literals and identifier keys of table literals are interned here
+// once and get the index of their string in gem_constants as their slot.
+// non-computed member expressions get the constant of their property name as
+// key and the index of their inline cache in gem_member_caches as slot.
+// function declarations get their prototype in gem_prototypes.
+class resolver {
+  public:
+    // returns the prototype of the top level code
+    const function_prototype *resolve(ast &program, scope *globals);
+
+  private:
+    struct resolver_scope {
+        std::unordered_map<std::string, int> slots{};
+        int first_slot = 0;
+    };
+
+    struct resolver_function {
+        std::vector<resolver_scope> scopes;
+        std::vector<upvalue_info> upvalues;
+        // slots taken by the open scopes
+        int size = 0;
+        int slot_count = 0;
+    };
+
+    // the top level code first, then the functions around the current node
+    std::vector<resolver_function> functions;
+    std::unordered_map<std::string, int> global_indices;
+    std::unordered_map<std::string, int> constant_indices;
+    scope *global_scope = nullptr;
+    ast *tree = nullptr;
+
+    void begin_scope();
+    void end_scope(int &first_slot, int &slot_count);
+    int declare(const std::string &name);
+    void hoist(node_list body);
+    void bind(variable_kind &binding, int &slot, string_index name);
+    int find_local(resolver_function &function, const std::string &name);
+    int resolve_upvalue(size_t function, const std::string &name);
+    int add_upvalue(resolver_function &function, bool in_stack, int index);
+    int global_index(const std::string &name);
+    int constant(const std::string &string);
+
+    void body(node_list nodes);
+    void statement(node_index node);
+    void function_declaration(function_node &node);
+    void for_loop(for_node &node);
+    void while_loop(while_node &node);
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#if defined(__SANITIZE_ADDRESS__) && !defined(GEM_NO_SLABS)
+#define GEM_NO_SLABS
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) && !defined(GEM_NO_SLABS)
+#define GEM_NO_SLABS
+#endif
+#endif
+
+// size class pools for the small cells the gc owns (objects, tables and
+// scopes). every class carves cells out of 64kb slabs with a bump pointer and
+// keeps the cells freed by the sweeper on an intrusive free list, slabs are
+// never handed back to the system.
+//
+// address sanitizer builds go straight to operator new so use after free
+// bugs in the collector still get caught.
+class slab_allocator {
+  public:
+    static constexpr size_t granularity = 16;
+    static constexpr size_t max_cell = 256;
+    static constexpr size_t slab_bytes = 64 * 1024;
+
+    void *allocate(size_t size) {
+#ifndef GEM_NO_SLABS
+        if (size <= max_cell) {
+            size_class &cells = classes[class_index(size)];
+
+            if (cells.free_list) {
+                free_cell *cell = cells.free_list;
+                cells.free_list = cell->next;
+                return cell;
+            }
+
+            size_t cell_size = (class_index(size) + 1) * granularity;
+            if (cells.bump + cell_size > cells.end) {
+                refill(cells);
+            }
+
+            void *cell = cells.bump;
+            cells.bump += cell_size;
+            return cell;
+        }
+#endif
+        return ::operator new(size);
+    }
+
+    void release(void *cell, size_t size) {
+#ifndef GEM_NO_SLABS
+        if (size <= max_cell) {
+            size_class &cells = classes[class_index(size)];
+            free_cell *freed = static_cast<free_cell *>(cell);
+            freed->next = cells.free_list;
+            cells.free_list = freed;
+            return;
+        }
+#endif
+        ::operator delete(cell);
+    }
+
+    size_t reserved_bytes() const {
+        return slabs.size() * slab_bytes;
+    }
+
+    ~slab_allocator() {
+        for (char *slab : slabs) {
+            ::operator delete(slab);
+        }
+    }
+
+  private:
+    struct free_cell {
+        free_cell *next;
+    };
+
+    struct size_class {
+        free_cell *free_list = nullptr;
+        char *bump = nullptr;
+        char *end = nullptr;
+    };
+
+    size_class classes[max_cell / granularity];
+    std::vector<char *> slabs;
+
+    static size_t class_index(size_t size) {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    void refill(size_class &cells) {
+        char *slab = static_cast<char *>(::operator new(slab_bytes));
+        slabs.push_back(slab);
+        cells.bump = slab;
+        cells.end = slab + slab_bytes;
+    }
+};
+
+inline slab_allocator gem_slabs;
+
+// gives a struct class level new and delete that go through gem_slabs
+#define GEM_SLAB_ALLOCATED                                                     \
+    static void *operator new(size_t size) {                                   \
+        return gem_slabs.allocate(size);                                       \
+    }                                                                          \
+    static void operator delete(void *cell, size_t size) {                     \
+        gem_slabs.release(cell, size);                                         \
+    }
@@ -21,6 +21,8 @@ inline bool compare_number(double x, double y, const std::string &op) {
 inline bool compare_string(std::string x, std::string y, const std::string &op) {
     if (op == "==")
         return x == y;
+    else if (op == "!=")
+        return x != y;
     else
         return false;
 }
@@ -28,6 +30,8 @@ inline bool compare_string(std::string x, std::string y, const std::string &op)
 inline bool compare_bool(bool x, bool y, const std::string &op) {
     if (op == "==")
         return x == y;
+    else if (op == "!=")
+        return x != y;
     else
         return false;
 }
@@ -35,6 +39,8 @@ inline bool compare_bool(bool x, bool y, const std::string &op) {
 inline bool compare_table(gem_table* x, gem_table* y, const std::string &op) {
     if (op == "==")
         return x == y;
+    else if (op == "!=")
+        return x != y;
     else
         return false;
 }
@@ -42,6 +48,8 @@ inline bool compare_table(gem_table* x, gem_table* y, const std::string &op) {
 inline bool compare_function(function* x, function* y, const std::string &op) {
     if (op == "==")
         return x == y;
+    else if (op == "!=")
+        return x != y;
     else
         return false;
 }
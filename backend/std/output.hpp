@@ -0,0 +1,118 @@
+#pragma once
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// when console.out hands its lines to the system
+enum class flush_policy {
+    // after every line, the default on a terminal
+    line,
+    // once flush_bytes are pending, the default for pipes and files
+    size,
+    // only on console.flush(), a full buffer and exit
+    explicit_flush,
+};
+
+// console.out writes through the buffer of std::cout, so its lines stay in
+// order with everything else printed there and with std::cerr, which flushes
+// std::cout before it writes. the channel only decides when to flush
+class output_channel {
+  public:
+    flush_policy policy = flush_policy::line;
+    size_t flush_bytes = 16 * 1024;
+
+    // has to run before anything is printed, the buffer of std::cout can not
+    // be changed afterwards
+    void open() {
+        std::ios::sync_with_stdio(false);
+        std::cout.rdbuf()->pubsetbuf(buffer, sizeof(buffer));
+    }
+
+    void write(std::string_view text) {
+        std::cout.write(text.data(), text.size());
+        pending += text.size();
+    }
+
+    // prints like streaming the double with the default precision
+    void write(double number) {
+        char digits[32];
+        auto result = std::to_chars(digits,
+            digits + sizeof(digits),
+            number,
+            std::chars_format::general,
+            6);
+        write(std::string_view(digits, result.ptr - digits));
+    }
+
+    void end_line() {
+        write("\n");
+
+        if (policy == flush_policy::line ||
+            (policy == flush_policy::size && pending >= flush_bytes)) {
+            flush();
+        }
+    }
+
+    void flush() {
+        std::cout.flush();
+        pending = 0;
+    }
+
+  private:
+    char buffer[64 * 1024];
+    size_t pending = 0;
+};
+
+inline output_channel gem_output;
+
+// line, size or explicit for flush and a byte count for bytes
+inline bool output_set_option(
+    const std::string &name, const std::string &value) {
+    if (name == "flush") {
+        if (value == "line") {
+            gem_output.policy = flush_policy::line;
+        } else if (value == "size") {
+            gem_output.policy = flush_policy::size;
+        } else if (value == "explicit") {
+            gem_output.policy = flush_policy::explicit_flush;
+        } else {
+            return false;
+        }
+        return true;
+    } else if (name == "bytes") {
+        char *end = nullptr;
+        unsigned long long bytes = std::strtoull(value.c_str(), &end, 10);
+        if (value.empty() || *end != '\0') {
+            return false;
+        }
+        gem_output.flush_bytes = bytes;
+        return true;
+    }
+
+    return false;
+}
+
+// terminals get every line right away, everything else is batched.
+// GEM_OUTPUT_FLUSH and GEM_OUTPUT_BYTES override it
+inline void output_configure_from_env() {
+    gem_output.policy =
+        isatty(STDOUT_FILENO) ? flush_policy::line : flush_policy::size;
+
+    for (const char *name : {"flush", "bytes"}) {
+        std::string variable = "GEM_OUTPUT_" + std::string(name);
+        for (char &c : variable) {
+            c = std::toupper(c);
+        }
+
+        const char *value = std::getenv(variable.c_str());
+        if (value && !output_set_option(name, value)) {
+            std::cerr << "Invalid value for " << variable << ": " << value
+                      << std::endl;
+            exit(1);
+        }
+    }
+}
@@ -1,6 +1,7 @@
 #include <inttypes.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,15 +14,27 @@ typedef enum {
 		gem_function, 
 		gem_table,
 		gem_nil,
+		gem_cell,
 } gem_object_type;
 
+// how far the cycle collector got with a function or cell
+typedef enum {
+    gem_black,
+    gem_gray,
+    gem_white,
+    gem_purple,
+} gem_color;
+
 typedef struct gem_object gem_object;
 
 struct gem_object {
     gem_object_type object_type;
+    uint8_t color;
+    // waits in the zero count table
+    bool deferred;
+    // waits in the cycle roots
+    bool buffered;
     uint64_t references;
-
-    void (*deconstructor)(gem_object *);
 };
 
 typedef struct {
@@ -39,12 +52,27 @@ typedef struct {
 } gem_object_nil;
 
 
+// strings know their length and are never changed once made. adding two
+// strings that are not short makes a rope that points at both sides, the
+// characters are only copied into one buffer the first time they are read.
+// literals are static objects that point at the C literal
 typedef struct {
     gem_object base;
+    // without the terminator
     uint64_t size;
+    // NULL while the string is a rope
     char *value;
+    gem_object *left;
+    gem_object *right;
 } gem_object_string;
 
+// a variable that closures capture, the closures and the function that
+// declares it share the cell so they all see its assignments
+typedef struct {
+    gem_object base;
+    gem_object *value;
+} gem_object_cell;
+
 
 
 typedef struct{
@@ -87,8 +115,8 @@ stack_trace* create_stack_trace(){
 void trace_add_trace(stack_trace* st, uint64_t Line, const char* Line_Info, bool native, const char* filename){
 	if(st->Size == st->Cap){
 		uint64_t newcap = (uint64_t)(st->Cap * 1.7);
-		stack_trace_info* Temp = malloc(sizeof(stack_trace_info*) * newcap);
-		memmove(Temp, st->Trace, st->Cap * sizeof(stack_trace_info*));
+		stack_trace_info* Temp = malloc(sizeof(stack_trace_info) * newcap);
+		memmove(Temp, st->Trace, st->Cap * sizeof(stack_trace_info));
 		free(st->Trace); 
 		st->Trace = Temp;
 		st->Cap = newcap;
@@ -121,7 +149,7 @@ void print_trace(stack_trace* st){
 }
 
 
-void gem_check_free(gem_object*);
+char *string_flatten(gem_object_string *string);
 
 void gem_print(gem_object* value){
 	switch(value->object_type){
@@ -129,7 +157,8 @@ void gem_print(gem_object* value){
 			printf("%.12g", ((gem_object_number*)value)->value);
 			break;
 		case gem_string:
-			printf("%s", ((gem_object_string*)value)->value);
+			fwrite(string_flatten((gem_object_string*)value), 1,
+				((gem_object_string*)value)->size, stdout);
 			break;
 		case gem_function:
 			printf("Function: %p", ((gem_object_function*)value)->FuncPtr);
@@ -144,7 +173,6 @@ void gem_print(gem_object* value){
 			printf("nil");
 			break;
 	}
-	gem_check_free(value);
 }
 
 void destroy_stack(stack_trace* st){
@@ -164,179 +192,561 @@ const char* get_type_name(gem_object_type tp){
 			return "boolean";
 		case gem_table:
 			return "function";
+		case gem_cell:
+			return "cell";
 		case gem_nil:
 		default:
 			return "nil";
 	}
 }
-void gem_check_free(gem_object *obj) {
+// Object Pools
+
+// freed objects of one type are kept on a free list and handed out again,
+// new ones are bumped out of chunks that are never given back
+typedef struct gem_pool_cell {
+    struct gem_pool_cell *next;
+} gem_pool_cell;
+
+typedef struct {
+    size_t object_size;
+    gem_pool_cell *free_list;
+    char *bump;
+    char *bump_end;
+    // every chunk starts with a pointer to the chunk before it
+    void *chunks;
+} gem_pool;
+
+#define GEM_POOL_CHUNK_SIZE (64 * 1024)
+// keeps the objects after the chunk link aligned
+#define GEM_POOL_CHUNK_HEADER 16
+
+gem_pool number_pool = {sizeof(gem_object_number)};
+gem_pool string_pool = {sizeof(gem_object_string)};
+gem_pool function_pool = {sizeof(gem_object_function)};
+gem_pool cell_pool = {sizeof(gem_object_cell)};
+
+void *pool_alloc(gem_pool *pool) {
+    if (pool->free_list != NULL) {
+        gem_pool_cell *cell = pool->free_list;
+        pool->free_list = cell->next;
+        return cell;
+    }
+
+    if (pool->bump == NULL ||
+        (size_t)(pool->bump_end - pool->bump) < pool->object_size) {
+        char *chunk = malloc(GEM_POOL_CHUNK_SIZE);
+        *(void **)chunk = pool->chunks;
+        pool->chunks = chunk;
+        pool->bump = chunk + GEM_POOL_CHUNK_HEADER;
+        pool->bump_end = chunk + GEM_POOL_CHUNK_SIZE;
+    }
+
+    void *object = pool->bump;
+    pool->bump += pool->object_size;
+    return object;
+}
+
+void pool_free(gem_pool *pool, void *object) {
+    gem_pool_cell *cell = object;
+    cell->next = pool->free_list;
+    pool->free_list = cell;
+}
+
+// Reference Counting
+
+// variables, cells and closures count their references, temporaries do not.
+// an object with a count of zero waits in the zero count table until the
+// next statement boundary, so the runtime functions never free their
+// operands and an expression can use a temporary as often as it likes.
+//
+// functions and cells can form cycles through captured variables. when their
+// count drops without reaching zero they become roots of a possible cycle
+// and trial deletion frees the cycles once enough roots are buffered
+typedef struct {
+    gem_object **items;
+    size_t size;
+    size_t capacity;
+} gem_object_stack;
+
+gem_object_stack zero_count_table;
+gem_object_stack cycle_roots;
+
+#define GEM_CYCLE_THRESHOLD 1024
+// temporaries a loop lets build up before it drains the zero count table
+#define GEM_ZCT_BATCH 64
+
+void object_stack_push(gem_object_stack *stack, gem_object *obj) {
+    if (stack->size == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->items =
+            realloc(stack->items, stack->capacity * sizeof(gem_object *));
+    }
+    stack->items[stack->size++] = obj;
+}
+
+// nil, true and false are shared by every value that holds them. they start
+// out deferred and buffered so they never enter the table or the roots
+gem_object_nil gem_nil_object = {
+    {.object_type = gem_nil, .deferred = true, .buffered = true}};
+gem_object_bool gem_true_object = {
+    {.object_type = gem_bool, .deferred = true, .buffered = true}, true};
+gem_object_bool gem_false_object = {
+    {.object_type = gem_bool, .deferred = true, .buffered = true}, false};
+
+// the compiler makes one of these for every distinct string literal
+#define GEM_STRING_LITERAL(text)                                              \
+    {{.object_type = gem_string, .deferred = true, .buffered = true},         \
+        sizeof(text) - 1,                                                     \
+        text}
+
+bool is_container(gem_object *obj) {
+    return obj->object_type == gem_function || obj->object_type == gem_cell;
+}
+
+void gem_defer(gem_object *obj) {
+    if (!obj->deferred) {
+        obj->deferred = true;
+        object_stack_push(&zero_count_table, obj);
+    }
+}
+
+void init_object(gem_object *obj, gem_object_type type) {
+    obj->object_type = type;
+    obj->color = gem_black;
+    obj->deferred = false;
+    obj->buffered = false;
+    obj->references = 0;
+    gem_defer(obj);
+}
+
+void gem_retain(gem_object *obj) {
+    obj->references++;
+    obj->color = gem_black;
+}
+
+void gem_release(gem_object *obj) {
+    obj->references--;
+
     if (obj->references == 0) {
+        gem_defer(obj);
+    } else if (is_container(obj) && obj->color != gem_purple) {
+        obj->color = gem_purple;
+        if (!obj->buffered) {
+            obj->buffered = true;
+            object_stack_push(&cycle_roots, obj);
+        }
+    }
+}
+
+void visit_children(gem_object *obj, void (*visit)(gem_object *)) {
+    if (obj->object_type == gem_function) {
+        gem_object_function *function = (gem_object_function *)obj;
+        for (uint64_t i = 0; i < function->incount; ++i) {
+            visit(function->internals[i]);
+        }
+    } else if (obj->object_type == gem_cell) {
+        visit(((gem_object_cell *)obj)->value);
+    } else if (obj->object_type == gem_string &&
+               ((gem_object_string *)obj)->value == NULL) {
+        visit(((gem_object_string *)obj)->left);
+        visit(((gem_object_string *)obj)->right);
+    }
+}
+
+void free_memory(gem_object *obj) {
+    switch (obj->object_type) {
+    case gem_number:
+        pool_free(&number_pool, obj);
+        break;
+    case gem_string:
+        free(((gem_object_string *)obj)->value);
+        pool_free(&string_pool, obj);
+        break;
+    case gem_function:
+        free(((gem_object_function *)obj)->internals);
+        pool_free(&function_pool, obj);
+        break;
+    case gem_cell:
+        pool_free(&cell_pool, obj);
+        break;
+    default:
+        break;
+    }
+}
+
+void free_object(gem_object *obj) {
 #ifdef O_DEBUG
-        printf("Freed %s Object Address: %p\n", get_type_name(obj->object_type), obj);
+    printf("Freed %s Object Address: %p\n", get_type_name(obj->object_type), obj);
 #endif
-        obj->deconstructor(obj);
+    visit_children(obj, gem_release);
+
+    // a buffered object is freed once the cycle collector drops it
+    obj->color = gem_black;
+    if (!obj->buffered) {
+        free_memory(obj);
     }
 }
 
-gem_object *gem_assign(gem_object *self, gem_object *value) {
-    self->references--;
-    value->references++;
+// trial deletion, counts that only come from inside the graph below the
+// roots drop to zero
 
-    gem_check_free(self);
+void mark_gray(gem_object *obj);
 
-    return value;
+void mark_gray_child(gem_object *child) {
+    if (is_container(child)) {
+        child->references--;
+        mark_gray(child);
+    }
 }
 
-void gem_default_deconstructor(gem_object *self) {
-    free(self);
+void mark_gray(gem_object *obj) {
+    if (obj->color != gem_gray) {
+        obj->color = gem_gray;
+        visit_children(obj, mark_gray_child);
+    }
 }
 
-void gem_function_deconstructor(gem_object *self){
-	for(uint64_t i = 0; i < ((gem_object_function*)self)->incount; ++i){
-		((gem_object_function*)self)->internals[i]->references--;
-		gem_check_free(((gem_object_function*)self)->internals[i]);
-	}
-	free(((gem_object_function*)self)->internals);
-	free(self);
+void scan_black(gem_object *obj);
+
+void scan_black_child(gem_object *child) {
+    if (is_container(child)) {
+        child->references++;
+        if (child->color != gem_black) {
+            scan_black(child);
+        }
+    }
+}
+
+void scan_black(gem_object *obj) {
+    obj->color = gem_black;
+    visit_children(obj, scan_black_child);
+}
+
+void scan(gem_object *obj);
+
+void scan_child(gem_object *child) {
+    if (is_container(child)) {
+        scan(child);
+    }
 }
 
-void gem_string_deconstructor(gem_object *self) {
-    free((((gem_object_string *)self)->value));
-    free(self);
+void scan(gem_object *obj) {
+    if (obj->color == gem_gray) {
+        if (obj->references > 0) {
+            scan_black(obj);
+        } else {
+            obj->color = gem_white;
+            visit_children(obj, scan_child);
+        }
+    }
+}
+
+void collect_white(gem_object *obj);
+
+// the edges to containers were already taken away by mark_gray
+void collect_white_child(gem_object *child) {
+    if (is_container(child)) {
+        collect_white(child);
+    } else {
+        gem_release(child);
+    }
+}
+
+void collect_white(gem_object *obj) {
+    if (obj->color == gem_white && !obj->buffered) {
+        obj->color = gem_black;
+        visit_children(obj, collect_white_child);
+        free_memory(obj);
+    }
+}
+
+// only runs when the zero count table is empty, so every object with a count
+// of zero has already released its children
+void gem_collect_cycles() {
+    size_t roots = 0;
+
+    for (size_t i = 0; i < cycle_roots.size; ++i) {
+        gem_object *obj = cycle_roots.items[i];
+
+        if (obj->color == gem_purple && obj->references > 0) {
+            mark_gray(obj);
+            cycle_roots.items[roots++] = obj;
+        } else {
+            // a root that an earlier root already marked gray is left to
+            // scan, only the ones the table already released are freed here
+            obj->buffered = false;
+            if (obj->color == gem_black && obj->references == 0) {
+                free_memory(obj);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < roots; ++i) {
+        scan(cycle_roots.items[i]);
+    }
+
+    for (size_t i = 0; i < roots; ++i) {
+        cycle_roots.items[i]->buffered = false;
+        collect_white(cycle_roots.items[i]);
+    }
+
+    cycle_roots.size = 0;
+}
+
+// every function remembers where the table stood when it was called and
+// frees the temporaries of a statement once it is done
+size_t gem_zct_mark() {
+    return zero_count_table.size;
+}
+
+void gem_zct_release(size_t mark) {
+    while (zero_count_table.size > mark) {
+        gem_object *obj = zero_count_table.items[--zero_count_table.size];
+        obj->deferred = false;
+
+        if (obj->references == 0) {
+            free_object(obj);
+        }
+    }
+
+    if (mark == 0 && cycle_roots.size >= GEM_CYCLE_THRESHOLD) {
+        gem_collect_cycles();
+        gem_zct_release(0);
+    }
+}
+
+// draining the table on every iteration costs more than the few temporaries
+// it frees, loops only drain it once a batch has built up
+void gem_zct_step(size_t mark) {
+    if (zero_count_table.size - mark >= GEM_ZCT_BATCH) {
+        gem_zct_release(mark);
+    }
+}
+
+// the return statement retains its value while it releases the locals, the
+// caller gets it back as a temporary of its own
+gem_object *gem_return(gem_object *value, size_t mark) {
+    gem_zct_release(mark);
+
+    value->references--;
+    if (value->references == 0) {
+        gem_defer(value);
+    }
+    return value;
+}
+
+// frees everything that is left once the program is done
+void gem_collect_garbage() {
+    gem_zct_release(0);
+    gem_collect_cycles();
+    gem_zct_release(0);
+
+    free(zero_count_table.items);
+    free(cycle_roots.items);
+}
+
+gem_object *gem_assign(gem_object *self, gem_object *value) {
+    gem_retain(value);
+    gem_release(self);
+
+    return value;
 }
 
 gem_object *make_number(double value) {
-    gem_object_number *ptr = malloc(sizeof(gem_object_number));
+    gem_object_number *ptr = pool_alloc(&number_pool);
 #ifdef O_DEBUG
     printf("New number Object At Address: %p\n", ptr);
 #endif
 
-    ptr->base.object_type = gem_number;
+    init_object(&ptr->base, gem_number);
     ptr->value = value;
-    ptr->base.references = 0;
-    ptr->base.deconstructor = gem_default_deconstructor;
 
     return (gem_object *)ptr;
 }
 
 gem_object *make_function(gem_object** internals, uint64_t incount, gem_object*(*FuncPtr)(stack_trace*, gem_object**, gem_object**), uint64_t expects){
-	  gem_object_function *ptr = malloc(sizeof(gem_object_function));
+	  gem_object_function *ptr = pool_alloc(&function_pool);
 		#ifdef O_DEBUG
     	printf("New function Object At Address: %p\n", ptr);
 	#endif
 
-    ptr->base.object_type = gem_function;
+    init_object(&ptr->base, gem_function);
 		ptr->expects = expects;
 		ptr->FuncPtr = FuncPtr;
 		ptr->internals = internals;
 		ptr->incount = incount; 
-    ptr->base.references = 0;
-    ptr->base.deconstructor = gem_function_deconstructor;
     return (gem_object *)ptr;
 };
 
 gem_object *make_nil() {
-    gem_object_nil *ptr = malloc(sizeof(gem_object_nil));
+    return (gem_object *)&gem_nil_object;
+}
+
+gem_object *make_bool(bool value) {
+    return (gem_object *)(value ? &gem_true_object : &gem_false_object);
+}
+
+// takes over value, a buffer of size characters and a terminator
+gem_object *make_string(char *value, uint64_t size) {
+    gem_object_string *ptr = pool_alloc(&string_pool);
 #ifdef O_DEBUG
-    printf("New nil Object At Address: %p\n", ptr);
+    printf("New string Object At Address: %p\n", ptr);
 #endif
 
-    ptr->base.object_type = gem_nil;
-    ptr->base.references = 0;
-    ptr->base.deconstructor = gem_default_deconstructor;
+    init_object(&ptr->base, gem_string);
+    ptr->size = size;
+    ptr->value = value;
+    ptr->left = NULL;
+    ptr->right = NULL;
 
     return (gem_object *)ptr;
 }
-gem_object *make_bool(bool value) {
-    gem_object_bool *ptr = malloc(sizeof(gem_object_bool));
-#ifdef O_DEBUG
-    printf("New bool Object At Address: %p\n", ptr);
-#endif
 
-    ptr->base.object_type = gem_bool;
-    ptr->value = value;
-    ptr->base.references = 0;
-    ptr->base.deconstructor = gem_default_deconstructor;
+// shorter results are copied right away, a rope node costs more than that
+#define GEM_ROPE_MIN_SIZE 64
+
+gem_object *make_rope(gem_object *left, gem_object *right) {
+    gem_object_string *ptr = (gem_object_string *)make_string(NULL,
+        ((gem_object_string *)left)->size + ((gem_object_string *)right)->size);
+
+    gem_retain(left);
+    gem_retain(right);
+    ptr->left = left;
+    ptr->right = right;
 
     return (gem_object *)ptr;
 }
 
-gem_object *make_string(const char *value) {
-    gem_object_string *ptr = malloc(sizeof(gem_object_string));
+// copies the leaves of a rope into one buffer. the ropes built in a loop
+// lean to the left as deep as the loop ran, so the nodes wait on a stack
+// instead of the C stack
+char *string_flatten(gem_object_string *string) {
+    if (string->value != NULL) {
+        return string->value;
+    }
+
+    char *buffer = malloc(string->size + 1);
+    uint64_t offset = string->size;
+    gem_object_stack pending = {0};
+    object_stack_push(&pending, (gem_object *)string);
+
+    // right to left, so a left leaning rope only ever has one node waiting
+    while (pending.size > 0) {
+        gem_object_string *node =
+            (gem_object_string *)pending.items[--pending.size];
+
+        if (node->value != NULL) {
+            offset -= node->size;
+            memcpy(buffer + offset, node->value, node->size);
+        } else {
+            object_stack_push(&pending, node->left);
+            object_stack_push(&pending, node->right);
+        }
+    }
+    free(pending.items);
+    buffer[string->size] = '\0';
+
+    gem_release(string->left);
+    gem_release(string->right);
+    string->value = buffer;
+    string->left = NULL;
+    string->right = NULL;
+
+    return buffer;
+}
+
+bool string_equal(gem_object_string *x, gem_object_string *y) {
+    return x == y || (x->size == y->size &&
+                         memcmp(string_flatten(x),
+                             string_flatten(y),
+                             x->size) == 0);
+}
+
+gem_object *make_cell(gem_object *value) {
+    gem_object_cell *ptr = pool_alloc(&cell_pool);
 #ifdef O_DEBUG
-    printf("New string Object At Address: %p\n", ptr);
+    printf("New cell Object At Address: %p\n", ptr);
 #endif
 
-    ptr->base.object_type = gem_string;
-    ptr->value = malloc(strlen(value) + 1);
-    ptr->size = strlen(value) + 1;
-    memcpy(ptr->value, value, ptr->size);
-    ptr->base.references = 0;
-    ptr->base.deconstructor = gem_string_deconstructor;
+    init_object(&ptr->base, gem_cell);
+    gem_retain(value);
+    ptr->value = value;
 
     return (gem_object *)ptr;
 }
 
-gem_object *copy_object(gem_object* obj){
-	switch(obj->object_type){
-		case gem_number:
-			return make_number( ((gem_object_number*)obj)->value );
-		case gem_string:
-			return make_string( ((gem_object_string*)obj)->value );
-		case gem_function:
-			gem_object** internals = malloc( sizeof(gem_object*) * ((gem_object_function*)obj)->incount );
-			for(uint64_t i = 0; i < ((gem_object_function*)obj)->incount; ++i){
-				internals[i] = copy_object( ((gem_object_function*)obj)->internals[i]);
-				internals[i]->references++;
-			}
-			return make_function(internals, ((gem_object_function*)obj)->incount, ((gem_object_function*)obj)->FuncPtr, ((gem_object_function*)obj)->expects);
-		case gem_bool:
-			return make_bool( ((gem_object_string*)obj)->value);
-		case gem_table:
-		case gem_nil:
-		default:
-			return make_nil();
-	}
+gem_object *gem_cell_get(gem_object *cell) {
+    return ((gem_object_cell *)cell)->value;
 }
 
-gem_object* gem_call_func(gem_object* Func, stack_trace* st, uint64_t count, gem_object** args){
-	gem_object** arguments = malloc( ((gem_object_function*)Func)->expects * sizeof(gem_object*) );
-	for(uint64_t i = 0; i < count; ++i){
-			if(i >= ((gem_object_function*)Func)->expects){
-				gem_check_free(args[i]);
-			}else{
-				arguments[i] = args[i];	
-			}
-	}
-	for(uint64_t i = count; i < ((gem_object_function*)Func)->expects; i++){
-		arguments[i] = make_nil();
-	}
-	return ((gem_object_function*)Func)->FuncPtr(st, ((gem_object_function*)Func)->internals, arguments);
+void gem_cell_set(gem_object *cell, gem_object *value) {
+    gem_object_cell *ptr = (gem_object_cell *)cell;
+    gem_retain(value);
+    gem_release(ptr->value);
+    ptr->value = value;
+}
+
+// the captured variables of a function, for direct calls
+gem_object **gem_internals(gem_object *function) {
+    return ((gem_object_function *)function)->internals;
 }
+
+// calls that fit in the window do not allocate
+#define GEM_CALL_WINDOW 8
+
+// surplus arguments are dropped and missing ones are nil
+gem_object *gem_call_func(
+    gem_object *Func, stack_trace *st, uint64_t count, gem_object **args) {
+    if (Func->object_type != gem_function) {
+        printf("%s:%" PRIu64 ": attemped to call '%s' \n", st->FileName, st->Line, get_type_name(Func->object_type));
+				print_trace(st);
+        exit(1);
+    }
+
+    gem_object_function *function = (gem_object_function *)Func;
+    if (count >= function->expects) {
+        return function->FuncPtr(st, function->internals, args);
+    }
+
+    gem_object *window[GEM_CALL_WINDOW];
+    gem_object **arguments = window;
+    if (function->expects > GEM_CALL_WINDOW) {
+        arguments = malloc(function->expects * sizeof(gem_object *));
+    }
+
+    for (uint64_t i = 0; i < function->expects; ++i) {
+        arguments[i] = i < count ? args[i] : make_nil();
+    }
+    gem_object *result =
+        function->FuncPtr(st, function->internals, arguments);
+
+    if (arguments != window) {
+        free(arguments);
+    }
+    return result;
+}
+
 gem_object *gem_add(stack_trace* st, gem_object *x, gem_object *y) {
     if (x->object_type == gem_number && y->object_type == gem_number) {
     		gem_object *result;
         result = make_number(
             ((gem_object_number *)x)->value + ((gem_object_number *)y)->value);
- 				gem_check_free(x);
-    		gem_check_free(y);
 				return result;
     } else if (x->object_type == gem_string && y->object_type == gem_string) {
-        char *string = malloc(sizeof(char) * ((gem_object_string *)x)->size +
-        ((gem_object_string *)y)->size - 1);
-        memcpy(string,
-            ((gem_object_string *)x)->value,
-            ((gem_object_string *)x)->size - 1);
-            memcpy(string + ((gem_object_string *)x)->size - 1,
-            ((gem_object_string *)x)->value,
-            ((gem_object_string *)y)->size);
-            gem_object *temporary = make_string(string);
-            free(string);
-            
-            gem_check_free(x);
-        gem_check_free(y);
-
-        return temporary;
+        gem_object_string *left = (gem_object_string *)x;
+        gem_object_string *right = (gem_object_string *)y;
+        uint64_t size = left->size + right->size;
+
+        if (size >= GEM_ROPE_MIN_SIZE) {
+            return make_rope(x, y);
+        }
+
+        char *string = malloc(size + 1);
+        memcpy(string, string_flatten(left), left->size);
+        memcpy(string + left->size, string_flatten(right), right->size);
+        string[size] = '\0';
+
+        return make_string(string, size);
     } else {
 				printf("%s:%" PRIu64 ": attemped to add '%s' and '%s' \n", st->FileName, st->Line, get_type_name(x->object_type), get_type_name(y->object_type));
 				print_trace(st);
@@ -357,8 +767,6 @@ gem_object *number_sub(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_number(
         ((gem_object_number *)x)->value - ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -372,8 +780,6 @@ gem_object *number_mul(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_number(
         ((gem_object_number *)x)->value * ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -387,8 +793,6 @@ gem_object *number_div(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_number(
         ((gem_object_number *)x)->value / ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -402,8 +806,6 @@ gem_object *number_pow(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_number(
         pow(((gem_object_number *)x)->value, ((gem_object_number *)y)->value));
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -415,10 +817,8 @@ gem_object *number_mod(stack_trace* st, gem_object *x, gem_object *y) {
 				exit(1);
     };
 
-    gem_object *result = make_number(modf(
-        ((gem_object_number *)x)->value, &((gem_object_number *)y)->value));
-    gem_check_free(x);
-    gem_check_free(y);
+    gem_object *result = make_number(fmod(
+        ((gem_object_number *)x)->value, ((gem_object_number *)y)->value));
 
     return result;
 }
@@ -437,8 +837,6 @@ gem_object *number_greaterThan(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_bool(
         ((gem_object_number *)x)->value > ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -452,8 +850,6 @@ gem_object *number_lessThan(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_bool(
         ((gem_object_number *)x)->value < ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -467,8 +863,6 @@ gem_object *number_greaterThanEqual(stack_trace* st, gem_object *x, gem_object *
 
     gem_object *result = make_bool(
         ((gem_object_number *)x)->value >= ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -482,8 +876,6 @@ gem_object *number_lessThanEqual(stack_trace* st, gem_object *x, gem_object *y)
 
     gem_object *result = make_bool(
         ((gem_object_number *)x)->value <= ((gem_object_number *)y)->value);
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -495,8 +887,7 @@ gem_object *gem_equal(stack_trace* st, gem_object *x, gem_object *y) {
         equal =
             ((gem_object_number *)x)->value == ((gem_object_number *)y)->value;
     } else if (x->object_type == gem_string && y->object_type == gem_string) {
-        equal = strcmp(((gem_object_string *)x)->value,
-                    ((gem_object_string *)y)->value) == 0;
+        equal = string_equal((gem_object_string *)x, (gem_object_string *)y);
     } else if (x->object_type == gem_bool && y->object_type == gem_bool) {
         equal = ((gem_object_bool *)x)->value == ((gem_object_bool *)y)->value;
     } else {
@@ -505,8 +896,6 @@ gem_object *gem_equal(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_bool(equal);
 
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -518,8 +907,7 @@ gem_object *gem_notEqual(stack_trace* st, gem_object *x, gem_object *y) {
         equal =
             ((gem_object_number *)x)->value != ((gem_object_number *)y)->value;
     } else if (x->object_type == gem_string && y->object_type == gem_string) {
-        equal = strcmp(((gem_object_string *)x)->value,
-                    ((gem_object_string *)y)->value) != 0;
+        equal = !string_equal((gem_object_string *)x, (gem_object_string *)y);
     } else if (x->object_type == gem_bool && y->object_type == gem_bool) {
         equal = ((gem_object_bool *)x)->value != ((gem_object_bool *)y)->value;
     } else {
@@ -528,8 +916,6 @@ gem_object *gem_notEqual(stack_trace* st, gem_object *x, gem_object *y) {
 
     gem_object *result = make_bool(equal);
 
-    gem_check_free(x);
-    gem_check_free(y);
 
     return result;
 }
@@ -543,7 +929,8 @@ gem_object *gem_not_operator(stack_trace* st, gem_object *value) {
     case gem_bool:
         return make_bool(!((gem_object_bool *)value)->value);
     case gem_string:
-        return make_bool(!((gem_object_string *)value)->value);
+        // every string is truthy
+        return make_bool(false);
     default:
 				printf("%s:%" PRIu64 ": attemped to use not on '%s' \n", st->FileName, st->Line, get_type_name(value->object_type));
 				print_trace(st);
@@ -553,6 +940,22 @@ gem_object *gem_not_operator(stack_trace* st, gem_object *value) {
 
 // Utility
 
-bool isTruthy(gem_object* bool_object) {
-    return ((gem_object_bool*)bool_object)->value;
+double gem_to_number(stack_trace* st, gem_object *value) {
+    if (value->object_type != gem_number) {
+        printf("%s:%" PRIu64 ": expected a number, got '%s' \n", st->FileName, st->Line, get_type_name(value->object_type));
+				print_trace(st);
+        exit(1);
+    }
+
+    double number = ((gem_object_number *)value)->value;
+
+    return number;
+}
+
+bool isTruthy(gem_object* value) {
+    bool truthy = value->object_type == gem_bool
+        ? ((gem_object_bool*)value)->value
+        : value->object_type != gem_nil;
+
+    return truthy;
 }
@@ -0,0 +1,526 @@
+#include "vm.hpp"
+#include "./magic_enum/magic_enum.hpp"
+#include "debugger.hpp"
+#include <cmath>
+#include <string>
+
+static gem_vm *active_vm = nullptr;
+
+static void mark_active_vm() {
+    if (active_vm) {
+        active_vm->mark_roots();
+    }
+}
+
+static inline bool truthy(gem_value value) {
+    if (value.is_bool()) {
+        return value.as_bool();
+    }
+
+    return !value.is_null();
+}
+
+static bool values_equal(gem_value x, gem_value y) {
+    if (x.is_number() && y.is_number()) {
+        return x.as_number() == y.as_number();
+    }
+
+    // strings are interned, equal contents means the same object
+    return x == y;
+}
+
+gem_vm::gem_vm(scope *globals) : globals(globals) {
+    gem_value table_value = globals->get_variable("table");
+    table_metadata = table_value.type() == gem_type::gem_table
+                         ? table_value.as_table()
+                         : nullptr;
+
+    stack.assign(vm_stack_size, gem_value::null());
+    frames.reserve(256);
+
+    static bool registered = false;
+    if (!registered) {
+        gc_roots.push_back(mark_active_vm);
+        registered = true;
+    }
+    active_vm = this;
+}
+
+gem_vm::~gem_vm() {
+    if (active_vm == this) {
+        active_vm = nullptr;
+    }
+}
+
+void gem_vm::mark_roots() {
+    // every slot below the highest frame window is marked, stale registers
+    // left behind by returned calls are never read but must stay valid
+    gem_value *top = stack.data();
+    for (auto &frame : frames) {
+        gem_value *frame_top = frame.base + frame.proto->register_count;
+        if (frame_top > top) {
+            top = frame_top;
+        }
+    }
+
+    for (gem_value *slot = stack.data(); slot < top; ++slot) {
+        mark_value(*slot);
+    }
+}
+
+int gem_vm::current_line() {
+    if (frames.empty()) {
+        return 0;
+    }
+
+    call_frame &frame = frames.back();
+    size_t index = frame.pc - frame.proto->code.data();
+    return index > 0 ? frame.proto->lines[index - 1] : 0;
+}
+
+void gem_vm::runtime_error(const std::string &message) {
+    std::string file_name =
+        frames.empty() ? globals->file_name : frames.back().proto->file_name;
+    error(error_type::runtime_error, "", file_name, current_line(), message);
+    exit(1);
+}
+
+std::shared_ptr<gem_upvalue> gem_vm::capture_upvalue(gem_value *slot) {
+    // open upvalues are sorted by stack slot, the newest ones at the back
+    size_t index = open_upvalues.size();
+    while (index > 0 && open_upvalues[index - 1]->location >= slot) {
+        if (open_upvalues[index - 1]->location == slot) {
+            return open_upvalues[index - 1];
+        }
+        index--;
+    }
+
+    auto upvalue = std::make_shared<gem_upvalue>(
+        gem_upvalue{.location = slot, .closed = gem_value::null()});
+    open_upvalues.insert(open_upvalues.begin() + index, upvalue);
+    return upvalue;
+}
+
+void gem_vm::close_upvalues(gem_value *level) {
+    while (!open_upvalues.empty() && open_upvalues.back()->location >= level) {
+        gem_upvalue *upvalue = open_upvalues.back().get();
+        upvalue->closed = *upvalue->location;
+        // the cell can be shared with closures that are already old
+        remember_value(upvalue->closed);
+        upvalue->location = &upvalue->closed;
+        open_upvalues.pop_back();
+    }
+}
+
+gem_value gem_vm::index_table(gem_value object, gem_value key) {
+    if (object.type() != gem_type::gem_table) {
+        runtime_error("Expected table, got " + gem_type_tostring(object.type()));
+    }
+
+    gem_table *table = object.as_table();
+
+    if (key.is_number()) {
+        if (std::isnan(key.as_number())) {
+            runtime_error("Attempted to index a table with NaN!");
+        }
+
+        gem_value *value = table->at(key);
+        if (value == nullptr) {
+            runtime_error("Out of bounds!");
+        }
+        return *value;
+    }
+
+    gem_value *value = table->hash_at(key);
+    if (value) {
+        return *value;
+    }
+
+    gem_table *metadata = object.as_object()->metadata;
+    if (metadata == nullptr) {
+        runtime_error("Attempted to index metadata of a non-metadata value!");
+    }
+
+    value = metadata->hash_at(key);
+    return value ? *value : gem_value::null();
+}
+
+// index_table for a constant string key, through the inline cache of the
+// instruction
+gem_value gem_vm::index_field(
+    gem_value object, gem_value key, member_cache &cache) {
+    if (object.type() != gem_type::gem_table) {
+        return index_table(object, key);
+    }
+
+    gem_value result;
+    if (member_cache_hit(cache, object.as_object(), result)) {
+        return result;
+    }
+
+    result = index_table(object, key);
+    member_cache_fill(cache, object.as_object(), key);
+    return result;
+}
+
+void gem_vm::set_table(gem_value object, gem_value key, gem_value value) {
+    if (object.type() != gem_type::gem_table) {
+        runtime_error("Expected table, got " + gem_type_tostring(object.type()));
+    }
+
+    if (key.is_number() && std::isnan(key.as_number())) {
+        runtime_error("Attempted to index a table with NaN!");
+    }
+
+    gem_table *table = object.as_table();
+    write_barrier(object.as_object(), key);
+    write_barrier(object.as_object(), value);
+    table->set(key, value);
+}
+
+gem_value gem_vm::run(gem_proto *proto) {
+    if (size_t(proto->register_count) + 1 > stack.size()) {
+        runtime_error("Stack overflow!");
+    }
+
+    frames.push_back(call_frame{.proto = proto,
+        .closure = nullptr,
+        .pc = proto->code.data(),
+        .base = stack.data() + 1,
+        .result = stack.data()});
+
+    return execute();
+}
+
+#define RK(x) ((x) & rk_constant ? constants[(x) & ~rk_constant] : base[(x)])
+#define SAVE_PC() (frame->pc = pc)
+#define MEMBER_CACHE()                                                         \
+    frame->proto->caches[pc - 1 - frame->proto->code.data()]
+#define LOAD_FRAME()                                                           \
+    frame = &frames.back();                                                    \
+    pc = frame->pc;                                                            \
+    base = frame->base;                                                        \
+    constants = frame->proto->constants.data();
+
+#define NUMBER_OPERATION(symbol, expression)                                   \
+    {                                                                          \
+        gem_value x = RK(op.b);                                                \
+        gem_value y = RK(op.c);                                                \
+        if (!x.is_number() || !y.is_number()) {                                \
+            SAVE_PC();                                                         \
+            runtime_error(dynamic_format(                                      \
+                "Attempted to use the '{}' operator on {} and {}!",            \
+                std::string(symbol),                                           \
+                gem_type_tostring(x.type()),                                   \
+                gem_type_tostring(y.type())));                                 \
+        }                                                                      \
+        double left = x.as_number();                                           \
+        double right = y.as_number();                                          \
+        base[op.a] = gem_value::number(expression);                            \
+        break;                                                                 \
+    }
+
+#define NUMBER_COMPARISON(comparison)                                          \
+    {                                                                          \
+        gem_value x = RK(op.b);                                                \
+        gem_value y = RK(op.c);                                                \
+        base[op.a] = gem_value::boolean(x.is_number() && y.is_number() &&      \
+                                        x.as_number() comparison y.as_number()); \
+        break;                                                                 \
+    }
+
+gem_value gem_vm::execute() {
+    call_frame *frame = &frames.back();
+    const instruction *pc = frame->pc;
+    gem_value *base = frame->base;
+    const gem_value *constants = frame->proto->constants.data();
+    size_t entry_depth = frames.size();
+
+    for (;;) {
+        const instruction op = *pc++;
+
+        switch (op.op) {
+        case op_code::load_const:
+            base[op.a] = constants[op.bx()];
+            break;
+        case op_code::load_null:
+            base[op.a] = gem_value::null();
+            break;
+        case op_code::load_bool:
+            base[op.a] = gem_value::boolean(op.b);
+            break;
+        case op_code::move:
+            base[op.a] = base[op.b];
+            break;
+        case op_code::get_global: {
+            gem_value value = *frame->proto->globals[op.bx()];
+            base[op.a] = value.is_empty() ? gem_value::null() : value;
+            break;
+        }
+        case op_code::define_global:
+            globals->write_barrier(base[op.a]);
+            *frame->proto->globals[op.bx()] = base[op.a];
+            break;
+        case op_code::set_global: {
+            gem_value *slot = frame->proto->globals[op.bx()];
+            if (slot->is_empty()) {
+                SAVE_PC();
+                runtime_error("Non-existent variable!");
+            }
+            globals->write_barrier(base[op.a]);
+            *slot = base[op.a];
+            break;
+        }
+        case op_code::get_upvalue:
+            base[op.a] = *frame->closure->upvalues[op.b]->location;
+            break;
+        case op_code::set_upvalue:
+            remember_value(base[op.a]);
+            *frame->closure->upvalues[op.b]->location = base[op.a];
+            break;
+        case op_code::close_upvalues:
+            close_upvalues(base + op.a);
+            break;
+        case op_code::closure: {
+            gem_proto *proto = frame->proto->protos[op.bx()];
+            gem_object *object = make_object(gem_type::gem_function);
+            function *func = new function;
+            func->function_type = gem_function_type::bytecode_function;
+            func->proto = proto;
+            func->upvalues.reserve(proto->upvalues.size());
+
+            for (auto &upvalue : proto->upvalues) {
+                func->upvalues.push_back(
+                    upvalue.in_stack ? capture_upvalue(base + upvalue.index)
+                                     : frame->closure->upvalues[upvalue.index]);
+            }
+
+            object->func = func;
+            base[op.a] = gem_value::object(object);
+            break;
+        }
+        case op_code::new_table: {
+            gem_table *table = new gem_table;
+            gem_object *object = make_object(gem_type::gem_table);
+            object->table = table;
+            object->metadata = table_metadata;
+            base[op.a] = gem_value::object(object);
+            break;
+        }
+        case op_code::get_field:
+            SAVE_PC();
+            base[op.a] =
+                index_field(base[op.b], constants[op.c], MEMBER_CACHE());
+            break;
+        case op_code::get_index:
+            SAVE_PC();
+            base[op.a] = index_table(base[op.b], RK(op.c));
+            break;
+        case op_code::set_index:
+            SAVE_PC();
+            set_table(base[op.a], RK(op.b), RK(op.c));
+            break;
+        case op_code::self: {
+            SAVE_PC();
+            gem_value object = base[op.b];
+            base[op.a + 1] = object;
+            base[op.a] = index_field(object, constants[op.c], MEMBER_CACHE());
+            break;
+        }
+        case op_code::add: {
+            gem_value x = RK(op.b);
+            gem_value y = RK(op.c);
+
+            if (x.is_number() && y.is_number()) {
+                base[op.a] = gem_value::number(x.as_number() + y.as_number());
+            } else if (x.type() == gem_type::gem_string &&
+                       y.type() == gem_type::gem_string) {
+                base[op.a] = make_string(x.as_string() + y.as_string());
+            } else {
+                SAVE_PC();
+                runtime_error(dynamic_format(
+                    "Attempted to use the '{}' operator on {} and {}!",
+                    std::string("+"),
+                    gem_type_tostring(x.type()),
+                    gem_type_tostring(y.type())));
+            }
+            break;
+        }
+        case op_code::sub:
+            NUMBER_OPERATION("-", left - right)
+        case op_code::mul:
+            NUMBER_OPERATION("*", left * right)
+        case op_code::div:
+            NUMBER_OPERATION("/", left / right)
+        case op_code::mod:
+            NUMBER_OPERATION("%", std::fmod(left, right))
+        case op_code::pow:
+            NUMBER_OPERATION("^", std::pow(left, right))
+        case op_code::eq:
+            base[op.a] = gem_value::boolean(values_equal(RK(op.b), RK(op.c)));
+            break;
+        case op_code::ne: {
+            // like the tree-walker, values of different types are never
+            // related, not even by '!='
+            gem_value left = RK(op.b);
+            gem_value right = RK(op.c);
+            base[op.a] = gem_value::boolean(
+                left.type() == right.type() && !values_equal(left, right));
+            break;
+        }
+        case op_code::lt:
+            NUMBER_COMPARISON(<)
+        case op_code::le:
+            NUMBER_COMPARISON(<=)
+        case op_code::gt:
+            NUMBER_COMPARISON(>)
+        case op_code::ge:
+            NUMBER_COMPARISON(>=)
+        case op_code::neg: {
+            gem_value value = base[op.b];
+            if (!value.is_number()) {
+                SAVE_PC();
+                runtime_error("Invalid unary expression! Expected number, got " +
+                              std::string(magic_enum::enum_name(value.type())) +
+                              "!");
+            }
+            base[op.a] = gem_value::number(-value.as_number());
+            break;
+        }
+        case op_code::not_:
+            base[op.a] = gem_value::boolean(!truthy(base[op.b]));
+            break;
+        case op_code::jump:
+            pc += op.sbx();
+            break;
+        case op_code::jump_if_false:
+            if (!truthy(base[op.a])) {
+                pc += op.sbx();
+            }
+            break;
+        case op_code::jump_if_true:
+            if (truthy(base[op.a])) {
+                pc += op.sbx();
+            }
+            break;
+        case op_code::for_prep: {
+            gem_value *loop = base + op.a;
+
+            for (int index = 0; index < 3; ++index) {
+                if (!loop[index].is_number()) {
+                    SAVE_PC();
+                    runtime_error("Expected gem_number, got " +
+                                  std::string(magic_enum::enum_name(
+                                      loop[index].type())));
+                }
+            }
+
+            if (loop[0].as_number() < loop[1].as_number()) {
+                loop[3] = loop[0];
+            } else {
+                pc += op.sbx();
+            }
+            break;
+        }
+        case op_code::for_loop: {
+            gem_value *loop = base + op.a;
+            double index = loop[0].as_number() + loop[2].as_number();
+            loop[0] = gem_value::number(index);
+
+            if (index < loop[1].as_number()) {
+                loop[3] = loop[0];
+                pc += op.sbx();
+            }
+            break;
+        }
+        case op_code::call: {
+            gem_value callee = base[op.a];
+
+            if (callee.type() != gem_type::gem_function) {
+                SAVE_PC();
+                runtime_error("Cannot call a non-function value(" +
+                              std::string(magic_enum::enum_name(callee.type())) +
+                              ")");
+            }
+
+            function *func = callee.as_function();
+            gem_value *args = base + op.a + 1;
+            uint16_t argument_count = op.b;
+
+            // self is only handed to natives, as their receiver
+            gem_value receiver = gem_value::empty();
+            if (op.c) {
+                receiver = args[0];
+                args++;
+                argument_count--;
+            }
+
+            SAVE_PC();
+
+            if (func->function_type == gem_function_type::bytecode_function) {
+                gem_proto *proto = func->proto;
+
+                if (frames.size() >= vm_max_frames ||
+                    args + proto->register_count >
+                        stack.data() + stack.size()) {
+                    runtime_error("Stack overflow!");
+                }
+
+                uint16_t first_unset = argument_count < proto->param_count
+                                           ? argument_count
+                                           : proto->param_count;
+                for (uint16_t index = first_unset;
+                     index < proto->register_count;
+                     ++index) {
+                    args[index] = gem_value::null();
+                }
+
+                frames.push_back(call_frame{.proto = proto,
+                    .closure = func,
+                    .pc = proto->code.data(),
+                    .base = args,
+                    .result = base + op.a});
+                LOAD_FRAME();
+                break;
+            }
+
+            if (func->function_type == gem_function_type::native_function ||
+                func->function_type == gem_function_type::metadata_function) {
+                base[op.a] = call_native(func,
+                    receiver,
+                    std::span<const gem_value>(args, argument_count),
+                    globals,
+                    current_line());
+                break;
+            }
+
+            runtime_error("Cannot call a tree-walker function from bytecode!");
+        }
+        case op_code::ret: {
+            gem_value result = op.b ? base[op.a] : gem_value::null();
+
+            if (!open_upvalues.empty()) {
+                close_upvalues(base);
+            }
+
+            *frame->result = result;
+            frames.pop_back();
+
+            if (frames.size() < entry_depth) {
+                return result;
+            }
+
+            LOAD_FRAME();
+            break;
+        }
+        }
+    }
+}
+
+gem_value run_bytecode(ast &program, scope *env) {
+    bytecode_compiler compiler;
+    gem_proto *proto = compiler.compile(program, env);
+
+    gem_vm vm(env);
+    return vm.run(proto);
+}
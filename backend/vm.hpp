@@ -0,0 +1,45 @@
+#pragma once
+#include "bytecode.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+constexpr size_t vm_stack_size = 1 << 18;
+constexpr size_t vm_max_frames = 1 << 14;
+
+struct call_frame {
+    gem_proto *proto;
+    function *closure;
+    const instruction *pc;
+    gem_value *base;
+    gem_value *result;
+};
+
+class gem_vm {
+  public:
+    explicit gem_vm(scope *globals);
+    ~gem_vm();
+
+    gem_value run(gem_proto *proto);
+    void mark_roots();
+
+  private:
+    scope *globals;
+    std::vector<gem_value> stack;
+    std::vector<call_frame> frames;
+    std::vector<std::shared_ptr<gem_upvalue>> open_upvalues;
+
+    gem_table *table_metadata;
+
+    gem_value execute();
+    std::shared_ptr<gem_upvalue> capture_upvalue(gem_value *slot);
+    void close_upvalues(gem_value *level);
+    gem_value index_table(gem_value object, gem_value key);
+    gem_value index_field(
+        gem_value object, gem_value key, member_cache &cache);
+    void set_table(gem_value object, gem_value key, gem_value value);
+    int current_line();
+    [[noreturn]] void runtime_error(const std::string &message);
+};
+
+gem_value run_bytecode(ast &program, scope *env);
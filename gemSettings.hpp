@@ -6,6 +6,7 @@ public:
     bool debug = false;
     bool verbose = false;
     bool benchmark = false;
+    bool bytecode = false;
     
     static Settings& get() {
         static Settings instance;
@@ -1,5 +1,9 @@
+#include "./backend/folder.hpp"
 #include "./backend/interpreter.hpp"
+#include "./backend/resolver.hpp"
 #include "./backend/std/values.hpp"
+#include "./backend/vm.hpp"
+#include "gemSettings.hpp"
 #include <algorithm>
 #include <cstring>
 #include <deque>
@@ -11,14 +15,20 @@
 #include <vector>
 
 scope *root = nullptr;
-u_int64_t MAX_ALLOCATIONS = 100;
 std::string read_file(std::ifstream &path) {
     std::string content((std::istreambuf_iterator<char>(path)), {});
     return content;
 }
 
-// gem ./main.gem
+// gem ./main.gem [--vm] [--gc-nursery=BYTES] [--gc-pause=PERCENT]
+//     [--gc-stepmul=PERCENT] [--gc-log] [--gc-stats]
+//     [--output-flush=line|size|explicit] [--output-bytes=BYTES]
+// the gc options can also be set with GEM_GC_NURSERY, GEM_GC_PAUSE,
+// GEM_GC_STEPMUL and GEM_GC_LOG, the output ones with GEM_OUTPUT_FLUSH and
+// GEM_OUTPUT_BYTES
 int main(int argc, char *argv[]) {
+    gem_output.open();
+
     std::filesystem::path file_path = argc > 1 ? argv[1] : "";
     std::ifstream file = std::ifstream(file_path);
 
@@ -27,25 +37,54 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
 
-    const char *prefix = "alloc=";
+    gc_configure_from_env();
+    output_configure_from_env();
+
+    const char *prefix = "--gc-";
     size_t prefix_len = std::strlen(prefix);
+    const char *output_prefix = "--output-";
+    size_t output_prefix_len = std::strlen(output_prefix);
+    bool print_gc_stats = false;
 
-    if (argc > 2 && std::strncmp(argv[2], prefix, prefix_len) == 0) {
-        std::string input;
-        while (true) {
-            std::cout << "Are you sure you want to manually set the max "
-                         "allocations? (y/n): ";
-            std::getline(std::cin, input);
+    for (int index = 2; index < argc; ++index) {
+        if (std::strcmp(argv[index], "--vm") == 0) {
+            settings.bytecode = true;
+            continue;
+        }
 
-            if (input == "y") {
-                break;
-            } else {
+        if (std::strcmp(argv[index], "--gc-stats") == 0) {
+            print_gc_stats = true;
+            continue;
+        }
+
+        if (std::strncmp(argv[index], output_prefix, output_prefix_len) == 0) {
+            std::string option = argv[index] + output_prefix_len;
+            size_t equals = option.find('=');
+
+            if (equals == std::string::npos ||
+                !output_set_option(
+                    option.substr(0, equals), option.substr(equals + 1))) {
+                std::cerr << "Invalid output option: " << argv[index]
+                          << std::endl;
                 exit(1);
             }
+            continue;
         }
 
-        MAX_ALLOCATIONS = std::atoi(argv[2] + prefix_len);
-        std::cout << "MAX ALLOCATIONS SET TO " << MAX_ALLOCATIONS << std::endl;
+        if (std::strncmp(argv[index], prefix, prefix_len) != 0) {
+            continue;
+        }
+
+        std::string option = argv[index] + prefix_len;
+        size_t equals = option.find('=');
+        std::string name = option.substr(0, equals);
+        std::string value =
+            equals == std::string::npos ? "1" : option.substr(equals + 1);
+
+        if (!gc_set_option(name, value)) {
+            std::cerr << "Invalid gc option: " << argv[index] << std::endl;
+            exit(1);
+        }
     }
 
     std::string content = read_file(file);
@@ -57,8 +96,20 @@ int main(int argc, char *argv[]) {
     define_globals(scope_class);
     garbage_collect();
 
-    astToken ast = parser_class->produceAST(content, file_path.stem().string());
-    interpret(ast, scope_class);
+    ast program = parser_class->produceAST(content, file_path.stem().string());
+    fold_constants(program);
+    if (settings.bytecode) {
+        run_bytecode(program, scope_class);
+    } else {
+        resolver resolver_class;
+        const function_prototype *main =
+            resolver_class.resolve(program, scope_class);
+        interpret_program(program, main, scope_class);
+    }
+    if (print_gc_stats) {
+        gc_print_stats(std::cerr);
+    }
+
     delete parser_class;
     delete scope_class;
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+# compiles a script to C, builds it with the address sanitizer and fails
+# when the program does not exit cleanly, the scripts check their own results
+# usage: cmake -DCOMPILER=<gem_compiler> -DCC=<c compiler> -DSCRIPT=<file.gem>
+#        -DOUTPUT=<dir> -P <this>
+
+get_filename_component(name ${SCRIPT} NAME_WE)
+set(source ${OUTPUT}/${name}.c)
+set(program ${OUTPUT}/${name})
+
+execute_process(
+    COMMAND ${COMPILER} ${SCRIPT} -o ${source}
+    OUTPUT_VARIABLE compiler_output
+    ERROR_VARIABLE compiler_output
+    RESULT_VARIABLE compiler_result)
+if(NOT compiler_result EQUAL 0 OR NOT EXISTS ${source})
+    message(FATAL_ERROR
+        "gem_compiler failed on ${SCRIPT} (exit ${compiler_result}):\n"
+        "${compiler_output}")
+endif()
+
+execute_process(
+    COMMAND ${CC} -g -w -fsanitize=address ${source} -lm -o ${program}
+    OUTPUT_VARIABLE cc_output
+    ERROR_VARIABLE cc_output
+    RESULT_VARIABLE cc_result)
+if(NOT cc_result EQUAL 0)
+    message(FATAL_ERROR
+        "the C output of ${SCRIPT} does not build:\n${cc_output}")
+endif()
+
+execute_process(
+    COMMAND ${program}
+    OUTPUT_VARIABLE program_output
+    ERROR_VARIABLE program_output
+    RESULT_VARIABLE program_result)
+if(NOT program_result EQUAL 0)
+    message(FATAL_ERROR
+        "${SCRIPT} failed (exit ${program_result}):\n${program_output}")
+endif()
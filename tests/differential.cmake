@@ -0,0 +1,23 @@
+# runs a script with the tree-walker and with the vm and fails when the two
+# engines do not print the same thing or do not exit the same way
+# usage: cmake -DINTERPRETER=<gem_interpreter> -DSCRIPT=<file.gem> -P <this>
+
+execute_process(
+    COMMAND ${INTERPRETER} ${SCRIPT}
+    OUTPUT_VARIABLE tree_walker_output
+    ERROR_VARIABLE tree_walker_output
+    RESULT_VARIABLE tree_walker_result)
+
+execute_process(
+    COMMAND ${INTERPRETER} ${SCRIPT} --vm
+    OUTPUT_VARIABLE vm_output
+    ERROR_VARIABLE vm_output
+    RESULT_VARIABLE vm_result)
+
+if(NOT tree_walker_output STREQUAL vm_output OR
+   NOT tree_walker_result STREQUAL vm_result)
+    message(FATAL_ERROR
+        "the engines disagree on ${SCRIPT}\n"
+        "tree-walker (exit ${tree_walker_result}):\n${tree_walker_output}\n"
+        "vm (exit ${vm_result}):\n${vm_output}")
+endif()